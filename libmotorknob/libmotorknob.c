@@ -0,0 +1,642 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+#include <linux/io_uring.h>
+
+#include "libmotorknob.h"
+
+// must match the report descriptor in the driver
+#define HID_REPORT_POSITION 1
+#define HID_REPORT_PROFILE  2
+#define HID_POSITION_SIZE   11 // id + position + timestamp_ns
+#define HID_POSITION_OLD    3  // drivers before the timestamp
+#define HID_PROFILE_SIZE    7
+
+enum {
+    PROFILE_START,
+    PROFILE_END,
+    PROFILE_DETENTS,
+    PROFILE_FILES,
+};
+
+static const char * const profile_files[PROFILE_FILES] = {
+    [PROFILE_START] = "profile/start_position",
+    [PROFILE_END] = "profile/end_position",
+    [PROFILE_DETENTS] = "profile/detents",
+};
+
+struct mk_knob {
+    int index;
+    char dir[64];
+    int position_fd;
+    int profile_fd[PROFILE_FILES];
+
+    // what we last wrote or read, lets profile writes skip unchanged values
+    struct mk_profile profile;
+    bool profile_valid;
+
+    int hidraw_fd;
+    int dev_fd;
+};
+
+void mk_encode_word(uint16_t value, uint8_t out[2]) {
+    out[0] = value >> 8;
+    out[1] = value & 0xff;
+}
+
+uint16_t mk_decode_word(const uint8_t in[2]) {
+    return in[0] | (in[1] << 8);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t decode_u64(const uint8_t in[8]) {
+    uint64_t value = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+static int open_attr(const struct mk_knob *knob, const char *name, int flags) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", knob->dir, name);
+    return open(path, flags | O_CLOEXEC);
+}
+
+/**
+ * One pread of a raw two byte attribute
+ */
+static int read_word(int fd, uint16_t *value) {
+    uint8_t buf[2];
+    ssize_t len = pread(fd, buf, sizeof(buf), 0);
+
+    if (len < 0) {
+        return -errno;
+    }
+    if (len != sizeof(buf)) {
+        return -EIO;
+    }
+
+    *value = mk_decode_word(buf);
+    return 0;
+}
+
+static int write_word(int fd, uint16_t value) {
+    uint8_t buf[2];
+    ssize_t len;
+
+    mk_encode_word(value, buf);
+    len = pwrite(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+        return -errno;
+    }
+
+    return len == sizeof(buf) ? 0 : -EIO;
+}
+
+struct mk_knob *mk_open(int index) {
+    struct mk_knob *knob = calloc(1, sizeof(*knob));
+    int i;
+
+    if (!knob) {
+        return NULL;
+    }
+
+    knob->index = index;
+    knob->hidraw_fd = -1;
+    knob->dev_fd = -1;
+    for (i = 0; i < PROFILE_FILES; i++) {
+        knob->profile_fd[i] = -1;
+    }
+    snprintf(knob->dir, sizeof(knob->dir), MK_SYSFS_ROOT "/knob%d", index);
+
+    knob->position_fd = open_attr(knob, "position", O_RDONLY);
+    if (knob->position_fd < 0) {
+        free(knob);
+        return NULL;
+    }
+
+    for (i = 0; i < PROFILE_FILES; i++) {
+        knob->profile_fd[i] = open_attr(knob, profile_files[i], O_RDWR);
+        if (knob->profile_fd[i] < 0) {
+            int err = errno;
+            mk_close(knob);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    return knob;
+}
+
+void mk_close(struct mk_knob *knob) {
+    int i;
+
+    if (!knob) {
+        return;
+    }
+
+    mk_events_close(knob);
+    if (knob->dev_fd >= 0) {
+        close(knob->dev_fd);
+    }
+    for (i = 0; i < PROFILE_FILES; i++) {
+        if (knob->profile_fd[i] >= 0) {
+            close(knob->profile_fd[i]);
+        }
+    }
+    close(knob->position_fd);
+    free(knob);
+}
+
+int mk_index(const struct mk_knob *knob) {
+    return knob->index;
+}
+
+int mk_read_position(struct mk_knob *knob, uint16_t *position) {
+    return read_word(knob->position_fd, position);
+}
+
+int mk_read_profile(struct mk_knob *knob, struct mk_profile *profile) {
+    int ret;
+
+    if ((ret = read_word(knob->profile_fd[PROFILE_START], &profile->start_position)) ||
+        (ret = read_word(knob->profile_fd[PROFILE_END], &profile->end_position)) ||
+        (ret = read_word(knob->profile_fd[PROFILE_DETENTS], &profile->detents))) {
+        return ret;
+    }
+
+    knob->profile = *profile;
+    knob->profile_valid = true;
+    return 0;
+}
+
+/**
+ * All three registers in one ioctl, the driver writes them back to back
+ */
+static int write_profile_hid(struct mk_knob *knob, const struct mk_profile *profile) {
+    uint8_t report[HID_PROFILE_SIZE] = { HID_REPORT_PROFILE };
+
+    report[1] = profile->start_position & 0xff;
+    report[2] = profile->start_position >> 8;
+    report[3] = profile->end_position & 0xff;
+    report[4] = profile->end_position >> 8;
+    report[5] = profile->detents & 0xff;
+    report[6] = profile->detents >> 8;
+
+    if (ioctl(knob->hidraw_fd, HIDIOCSFEATURE(sizeof(report)), report) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int write_profile_sysfs(struct mk_knob *knob, const struct mk_profile *profile) {
+    const uint16_t values[PROFILE_FILES] = {
+        [PROFILE_START] = profile->start_position,
+        [PROFILE_END] = profile->end_position,
+        [PROFILE_DETENTS] = profile->detents,
+    };
+    const uint16_t cached[PROFILE_FILES] = {
+        [PROFILE_START] = knob->profile.start_position,
+        [PROFILE_END] = knob->profile.end_position,
+        [PROFILE_DETENTS] = knob->profile.detents,
+    };
+    int i;
+
+    for (i = 0; i < PROFILE_FILES; i++) {
+        int ret;
+
+        if (knob->profile_valid && values[i] == cached[i]) {
+            continue;
+        }
+
+        ret = write_word(knob->profile_fd[i], values[i]);
+        if (ret) {
+            // partially written, do not trust the cache anymore
+            knob->profile_valid = false;
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int mk_write_profile(struct mk_knob *knob, const struct mk_profile *profile) {
+    int ret;
+
+    if (knob->profile_valid && !memcmp(&knob->profile, profile, sizeof(*profile))) {
+        return 0;
+    }
+
+    if (knob->hidraw_fd >= 0) {
+        ret = write_profile_hid(knob, profile);
+    } else {
+        ret = write_profile_sysfs(knob, profile);
+    }
+
+    if (ret) {
+        knob->profile_valid = false;
+        return ret;
+    }
+
+    knob->profile = *profile;
+    knob->profile_valid = true;
+    return 0;
+}
+
+int mk_read_attr(struct mk_knob *knob, const char *name, long *value) {
+    char buf[64];
+    ssize_t len;
+    char *end;
+    int fd = open_attr(knob, name, O_RDONLY);
+
+    if (fd < 0) {
+        return -errno;
+    }
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        return -errno;
+    }
+    buf[len] = '\0';
+
+    errno = 0;
+    *value = strtol(buf, &end, 0);
+    if (errno || end == buf) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int mk_write_attr(struct mk_knob *knob, const char *name, long value) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%ld\n", value);
+    ssize_t written;
+    int fd = open_attr(knob, name, O_WRONLY);
+
+    if (fd < 0) {
+        return -errno;
+    }
+
+    written = write(fd, buf, len);
+    close(fd);
+    if (written < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds /dev/hidrawX belonging to the Knob
+ * The driver sets HID_PHYS to "<i2c device>/input0"
+ */
+static int find_hidraw(const struct mk_knob *knob, char *path, size_t size) {
+    char link[PATH_MAX];
+    char phys[PATH_MAX];
+    char line[PATH_MAX];
+    struct dirent *entry;
+    ssize_t len;
+    DIR *dir;
+    int ret = -ENODEV;
+
+    snprintf(path, size, "%s/device", knob->dir);
+    len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0) {
+        return -errno;
+    }
+    link[len] = '\0';
+    snprintf(phys, sizeof(phys), "HID_PHYS=%s/input0\n", basename(link));
+
+    dir = opendir("/sys/class/hidraw");
+    if (!dir) {
+        return -errno;
+    }
+
+    while (ret == -ENODEV && (entry = readdir(dir))) {
+        FILE *uevent;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, size, "/sys/class/hidraw/%s/device/uevent", entry->d_name);
+        uevent = fopen(path, "re");
+        if (!uevent) {
+            continue;
+        }
+
+        while (fgets(line, sizeof(line), uevent)) {
+            if (!strcmp(line, phys)) {
+                snprintf(path, size, "/dev/%s", entry->d_name);
+                ret = 0;
+                break;
+            }
+        }
+        fclose(uevent);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+int mk_events_open(struct mk_knob *knob) {
+    char path[PATH_MAX];
+    int ret;
+
+    if (knob->hidraw_fd >= 0) {
+        return 0;
+    }
+
+    ret = find_hidraw(knob, path, sizeof(path));
+    if (ret) {
+        return ret;
+    }
+
+    knob->hidraw_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (knob->hidraw_fd < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+void mk_events_close(struct mk_knob *knob) {
+    if (knob->hidraw_fd >= 0) {
+        close(knob->hidraw_fd);
+        knob->hidraw_fd = -1;
+    }
+}
+
+int mk_events_fd(const struct mk_knob *knob) {
+    return knob->hidraw_fd;
+}
+
+int mk_events_epoll_add(struct mk_knob *knob, int epoll_fd, void *data) {
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = data,
+    };
+
+    if (knob->hidraw_fd < 0) {
+        return -EBADF;
+    }
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, knob->hidraw_fd, &event) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int mk_events_read(struct mk_knob *knob, struct mk_event *events, int count) {
+    uint8_t report[HID_POSITION_SIZE];
+    int n = 0;
+
+    if (knob->hidraw_fd < 0) {
+        return -EBADF;
+    }
+
+    // hidraw hands out one report per read
+    while (n < count) {
+        ssize_t len = read(knob->hidraw_fd, report, sizeof(report));
+
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return n ? n : -errno;
+        }
+        if ((len != HID_POSITION_SIZE && len != HID_POSITION_OLD) || report[0] != HID_REPORT_POSITION) {
+            continue;
+        }
+
+        events[n].timestamp_ns = len == HID_POSITION_SIZE ? decode_u64(&report[3]) : now_ns();
+        events[n].position = report[1] | (report[2] << 8);
+        n++;
+    }
+
+    return n;
+}
+
+int mk_dev_fd(struct mk_knob *knob) {
+    char path[32];
+
+    if (knob->dev_fd >= 0) {
+        return knob->dev_fd;
+    }
+
+    // writable if we may, reading works either way
+    snprintf(path, sizeof(path), "/dev/motorknob%d", knob->index);
+    knob->dev_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (knob->dev_fd < 0 && (errno == EACCES || errno == EPERM || errno == EROFS)) {
+        knob->dev_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    return knob->dev_fd < 0 ? -errno : knob->dev_fd;
+}
+
+int mk_history(struct mk_knob *knob, uint64_t since_ns, struct motorknob_sample *samples,
+               uint32_t count, uint32_t *flags) {
+    struct motorknob_history history = {
+        .since_ns = since_ns,
+        .count = count,
+        .samples = (uintptr_t) samples,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_HISTORY, &history) < 0) {
+        return -errno;
+    }
+
+    if (flags) {
+        *flags = history.flags;
+    }
+    return history.count;
+}
+
+int mk_position(struct mk_knob *knob, uint64_t max_age_ns, struct motorknob_sample *sample) {
+    struct motorknob_position position = {
+        .max_age_ns = max_age_ns,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_POSITION, &position) < 0) {
+        return -errno;
+    }
+
+    *sample = position.sample;
+    return 0;
+}
+
+int mk_zones(struct mk_knob *knob, const struct motorknob_zone *zones, uint32_t count, int eventfd,
+             uint32_t *inside) {
+    struct motorknob_zones args = {
+        .zones = (uintptr_t) zones,
+        .count = count,
+        .eventfd = eventfd,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_ZONES, &args) < 0) {
+        return -errno;
+    }
+
+    if (inside) {
+        *inside = args.inside;
+    }
+    return 0;
+}
+
+int mk_zone_events(struct mk_knob *knob, struct motorknob_zone_event *events, int count) {
+    int fd = mk_dev_fd(knob);
+    ssize_t len;
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    len = read(fd, events, count * sizeof(*events));
+    if (len < 0) {
+        return -errno;
+    }
+    return len / sizeof(*events);
+}
+
+int mk_context(struct mk_knob *knob, const struct mk_profile *profile) {
+    struct motorknob_context context = {
+        .start_position = profile->start_position,
+        .end_position = profile->end_position,
+        .detents = profile->detents,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_CONTEXT, &context) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int mk_focus(struct mk_knob *knob) {
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_FOCUS) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int mk_sequence(struct mk_knob *knob, struct motorknob_command *commands, uint32_t count) {
+    struct motorknob_sequence sequence = {
+        .commands = (uintptr_t) commands,
+        .count = count,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (ioctl(fd, MOTORKNOB_IOC_SEQUENCE, &sequence) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int mk_uring_prep_batch(struct mk_knob *knob, struct io_uring_sqe *sqe, struct motorknob_op *ops, uint32_t count) {
+    struct motorknob_uring_batch batch = {
+        .ops = (uintptr_t) ops,
+        .count = count,
+    };
+    int fd = mk_dev_fd(knob);
+
+    if (fd < 0) {
+        return fd;
+    }
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd;
+    sqe->cmd_op = MOTORKNOB_URING_CMD_BATCH;
+    memcpy(sqe->cmd, &batch, sizeof(batch));
+    return 0;
+}
+
+int mk_ctl_open(void) {
+    int fd = open(MK_CTL_DEV, O_RDONLY | O_CLOEXEC);
+
+    return fd < 0 ? -errno : fd;
+}
+
+int mk_snapshot(int ctl_fd, struct motorknob_sample *samples, uint32_t count, uint32_t flags) {
+    struct motorknob_snapshot snapshot = {
+        .flags = flags,
+        .count = count,
+        .samples = (uintptr_t) samples,
+    };
+
+    if (ioctl(ctl_fd, MOTORKNOB_IOC_SNAPSHOT, &snapshot) < 0) {
+        return -errno;
+    }
+
+    return snapshot.count;
+}
+
+int mk_trigger(int ctl_fd, uint64_t at_ns) {
+    struct motorknob_trigger trigger = {
+        .at_ns = at_ns,
+    };
+
+    if (ioctl(ctl_fd, MOTORKNOB_IOC_TRIGGER_ALL, &trigger) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * libmotorknob
+ * Small userspace library wrapping the interfaces of the MotorKnob driver,
+ * so nobody has to re-implement the byte encoding or polling loops.
+ *
+ * Functions return 0 (or a count) on success and -errno on failure.
+ */
+#ifndef LIBMOTORKNOB_H
+#define LIBMOTORKNOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "motorknob.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MK_SYSFS_ROOT "/sys/motorknob"
+#define MK_CTL_DEV    "/dev/motorknob"
+
+struct mk_knob;
+struct io_uring_sqe;
+
+struct mk_profile {
+    uint16_t start_position;
+    uint16_t end_position;
+    uint16_t detents;
+};
+
+/**
+ * One position update from the event stream
+ * timestamp_ns is CLOCK_MONOTONIC when the driver sampled it (the interrupt time
+ * if the Knob has one), older drivers only give when the library read it
+ */
+struct mk_event {
+    uint64_t timestamp_ns;
+    uint16_t position;
+};
+
+/*
+ * Raw register encoding of the sysfs files
+ * Writes expect the high byte first, reads return the low byte first.
+ */
+void mk_encode_word(uint16_t value, uint8_t out[2]);
+uint16_t mk_decode_word(const uint8_t in[2]);
+
+/**
+ * Opens /sys/motorknob/knobN
+ * File descriptors stay open, so reads are one pread each
+ */
+struct mk_knob *mk_open(int index);
+void mk_close(struct mk_knob *knob);
+int mk_index(const struct mk_knob *knob);
+
+/**
+ * Reads the position, at most one bus transaction shared with concurrent readers
+ * and none if the known one is younger than the Knob's max_age_us
+ */
+int mk_read_position(struct mk_knob *knob, uint16_t *position);
+
+/**
+ * Reads or writes the whole profile
+ * Writes go out as one HID feature report while the event stream is open,
+ * otherwise as up to three sysfs writes, skipping unchanged values.
+ */
+int mk_read_profile(struct mk_knob *knob, struct mk_profile *profile);
+int mk_write_profile(struct mk_knob *knob, const struct mk_profile *profile);
+
+/**
+ * Reads or writes a plain integer attribute relative to the Knob directory,
+ * e.g. "sampler/rate" or "control/enabled"
+ */
+int mk_read_attr(struct mk_knob *knob, const char *name, long *value);
+int mk_write_attr(struct mk_knob *knob, const char *name, long value);
+
+/*
+ * Event stream
+ * Position changes as pushed by the sampler through hidraw.
+ * The driver samples as long as the stream is open.
+ */
+int mk_events_open(struct mk_knob *knob);
+void mk_events_close(struct mk_knob *knob);
+
+/**
+ * File descriptor to put into poll/epoll, readable when events are pending
+ */
+int mk_events_fd(const struct mk_knob *knob);
+
+/**
+ * Adds the event stream to an epoll instance, data is handed back in epoll_event
+ */
+int mk_events_epoll_add(struct mk_knob *knob, int epoll_fd, void *data);
+
+/**
+ * Reads up to count pending events straight into events
+ * Returns the number read, 0 if nothing is pending
+ */
+int mk_events_read(struct mk_knob *knob, struct mk_event *events, int count);
+
+/*
+ * Per Knob device /dev/motorknobN
+ * Opened on first use and kept open.
+ */
+
+/**
+ * File descriptor of /dev/motorknobN, readable when new samples
+ * arrived since the last mk_history call
+ * Opened for writing if permissions allow, the calls changing the Knob need that.
+ */
+int mk_dev_fd(struct mk_knob *knob);
+
+/**
+ * Copies up to count samples newer than since_ns, oldest first, straight into samples
+ * Returns the number copied, flags gets MOTORKNOB_HISTORY_* (may be NULL)
+ */
+int mk_history(struct mk_knob *knob, uint64_t since_ns, struct motorknob_sample *samples,
+               uint32_t count, uint32_t *flags);
+
+/**
+ * Latest position, the Knob is only asked if the known one is older than max_age_ns
+ */
+int mk_position(struct mk_knob *knob, uint64_t max_age_ns, struct motorknob_sample *sample);
+
+/**
+ * Replaces the zones watched through mk_dev_fd, count 0 removes them
+ * eventfd is signaled on every event (-1 for none), inside gets the zones
+ * the Knob is in right now (may be NULL)
+ * mk_dev_fd then polls POLLPRI while events are waiting
+ */
+int mk_zones(struct mk_knob *knob, const struct motorknob_zone *zones, uint32_t count, int eventfd,
+             uint32_t *inside);
+
+/**
+ * Reads up to count zone events, blocks until there is at least one
+ * Returns the number read
+ */
+int mk_zone_events(struct mk_knob *knob, struct motorknob_zone_event *events, int count);
+
+/**
+ * Sets the profile context of this process' mk_dev_fd, the Knob gets it while it has the focus
+ * mk_focus takes the focus, it stays until another file takes it or mk_close
+ */
+int mk_context(struct mk_knob *knob, const struct mk_profile *profile);
+int mk_focus(struct mk_knob *knob);
+
+/**
+ * Writes each command at its at_ns and returns once all ran
+ * Every command gets its result and how late it ran, a signal cancels the rest.
+ */
+int mk_sequence(struct mk_knob *knob, struct motorknob_command *commands, uint32_t count);
+
+/**
+ * Fills an IORING_OP_URING_CMD SQE running up to 64 register ops as one batch
+ * ops must stay around until the CQE, each gets its result (and reads their value) there
+ */
+int mk_uring_prep_batch(struct mk_knob *knob, struct io_uring_sqe *sqe, struct motorknob_op *ops, uint32_t count);
+
+/*
+ * Snapshot of all Knobs
+ * Samples are copied by the kernel straight into the caller's buffer.
+ */
+int mk_ctl_open(void);
+
+/**
+ * Returns the number of Knobs, which may be more than count
+ * flags: MOTORKNOB_SNAPSHOT_FRESH
+ */
+int mk_snapshot(int ctl_fd, struct motorknob_sample *samples, uint32_t count, uint32_t flags);
+
+/**
+ * Has every Knob read its position at at_ns (CLOCK_MONOTONIC, 0 for now)
+ * minus its sampler/trigger_offset_us, e.g. the next vblank
+ */
+int mk_trigger(int ctl_fd, uint64_t at_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
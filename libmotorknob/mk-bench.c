@@ -0,0 +1,107 @@
+/*
+ * Compares the ways of getting positions out of the driver
+ *
+ * usage: mk-bench [knob] [iterations]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libmotorknob.h"
+
+#define MAX_KNOBS 64
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t start, int iterations, int errors) {
+    uint64_t ns = (now_ns() - start) / iterations;
+
+    printf("%-28s %10llu ns/op %10llu op/s", name, (unsigned long long) ns,
+           ns ? 1000000000ull / ns : 0ull);
+    if (errors) {
+        printf("  (%d errors)", errors);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int index = argc > 1 ? atoi(argv[1]) : 0;
+    int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+    struct motorknob_sample samples[MAX_KNOBS];
+    struct mk_profile profile;
+    struct mk_knob *knob;
+    uint16_t position;
+    uint64_t start;
+    int errors;
+    int ctl;
+    int i;
+
+    knob = mk_open(index);
+    if (!knob) {
+        fprintf(stderr, "Cannot open knob%d: %s\n", index, strerror(errno));
+        return 1;
+    }
+
+    errors = 0;
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        errors += mk_read_position(knob, &position) != 0;
+    }
+    report("sysfs position", start, iterations, errors);
+
+    errors = 0;
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        errors += mk_read_profile(knob, &profile) != 0;
+    }
+    report("sysfs profile (3 reads)", start, iterations, errors);
+
+    ctl = mk_ctl_open();
+    if (ctl >= 0) {
+        errors = 0;
+        start = now_ns();
+        for (i = 0; i < iterations; i++) {
+            errors += mk_snapshot(ctl, samples, MAX_KNOBS, 0) < 0;
+        }
+        report("snapshot cached (all)", start, iterations, errors);
+
+        errors = 0;
+        start = now_ns();
+        for (i = 0; i < iterations; i++) {
+            errors += mk_snapshot(ctl, samples, MAX_KNOBS, MOTORKNOB_SNAPSHOT_FRESH) < 0;
+        }
+        report("snapshot fresh (all)", start, iterations, errors);
+        close(ctl);
+    } else {
+        fprintf(stderr, "No %s: %s\n", MK_CTL_DEV, strerror(-ctl));
+    }
+
+    if (mk_events_open(knob) == 0) {
+        struct mk_event events[64];
+        uint64_t deadline = now_ns() + 1000000000ull;
+        long received = 0;
+
+        while (now_ns() < deadline) {
+            int n = mk_events_read(knob, events, 64);
+            if (n > 0) {
+                received += n;
+            } else {
+                usleep(100);
+            }
+        }
+        printf("%-28s %10ld events in 1s\n", "hidraw event stream", received);
+    } else {
+        fprintf(stderr, "No hidraw for knob%d\n", index);
+    }
+
+    mk_close(knob);
+    return 0;
+}
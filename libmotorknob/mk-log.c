@@ -0,0 +1,502 @@
+/*
+ * Logs the position of one Knob to disk for days, and reads it back
+ *
+ * usage: mk-log record <knob> <file> [flush seconds]
+ *        mk-log cat <file> [from_ns [to_ns]]   text, one "timestamp_ns position" per line
+ *        mk-log raw <file> [from_ns [to_ns]]   struct motorknob_sample records
+ *
+ * Samples come from the history of /dev/motorknobN, so nothing is lost between
+ * wakeups however busy the machine is, and sampling is forced on while recording.
+ *
+ * File format, all little endian:
+ *   header  "MKLOG01\n", u32 knob index, u32 reserved
+ *   chunk   u32 "MKCH", u32 flags, u32 count, u32 size, u64 first timestamp, u16 first position, u16 reserved,
+ *           then size bytes: per sample varint(timestamp delta), varint(zigzag(position delta)),
+ *           deltas to the previous sample, the first one to the chunk header
+ * A sample typically takes 3-4 bytes instead of 16 (or ~25 as text).
+ * <file>.idx holds u64 first timestamp, u64 file offset per chunk for seeking.
+ * A chunk cut short by a crash ends the log, everything before it stays readable.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libmotorknob.h"
+
+#define LOG_MAGIC       "MKLOG01\n"
+#define LOG_HEADER_SIZE 16
+#define CHUNK_MAGIC     0x4843484bu // "MKCH"
+#define CHUNK_HEADER_SIZE 28
+#define CHUNK_GAP       (1u << 0)   // samples before this chunk were lost
+
+#define CHUNK_SAMPLES   4096
+#define WRITE_BUFFER    (1 << 20)
+#define HISTORY_BATCH   1024
+
+struct chunk {
+    uint32_t flags;
+    uint32_t count;
+    uint64_t first_ts;
+    uint16_t first_pos;
+    uint64_t last_ts;
+    uint16_t last_pos;
+    uint8_t payload[CHUNK_SAMPLES * (10 + 3)];
+    size_t size;
+};
+
+struct writer {
+    int fd;
+    int idx_fd;
+    uint64_t offset;  // file offset of buf[0]
+    uint64_t synced;  // everything before was handed to writeback
+    uint8_t *buf;
+    size_t len;
+    uint8_t idx[256 * 16];
+    size_t idx_len;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, v);
+    put_u32(p + 4, v >> 32);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | (uint32_t) get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+/**
+ * Returns the bytes used, 0 if the varint runs past end
+ */
+static size_t get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    size_t n = 0;
+    int shift = 0;
+
+    *v = 0;
+    while (p + n < end && shift < 64) {
+        uint8_t b = p[n++];
+
+        *v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return n;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static uint32_t zigzag(int16_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 15);
+}
+
+static int16_t unzigzag(uint32_t v) {
+    return (int16_t) ((v >> 1) ^ -(v & 1));
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Writes out the buffer in one go and keeps the page cache from filling up over days
+ */
+static int writer_flush(struct writer *w) {
+    int ret;
+
+    if (w->len) {
+        ret = write_all(w->fd, w->buf, w->len);
+        if (ret < 0) {
+            return ret;
+        }
+        w->offset += w->len;
+        w->len = 0;
+    }
+
+    if (w->idx_len) {
+        ret = write_all(w->idx_fd, w->idx, w->idx_len);
+        if (ret < 0) {
+            return ret;
+        }
+        w->idx_len = 0;
+    }
+
+    // start writeback now, drop what was written back by the previous flush
+    sync_file_range(w->fd, w->synced, w->offset - w->synced, SYNC_FILE_RANGE_WRITE);
+    posix_fadvise(w->fd, 0, w->synced, POSIX_FADV_DONTNEED);
+    w->synced = w->offset;
+    return 0;
+}
+
+static void chunk_add(struct chunk *c, const struct motorknob_sample *s) {
+    if (c->count == 0) {
+        c->first_ts = c->last_ts = s->timestamp_ns;
+        c->first_pos = c->last_pos = s->position;
+    }
+
+    c->size += put_varint(c->payload + c->size, s->timestamp_ns - c->last_ts);
+    c->size += put_varint(c->payload + c->size, zigzag((int16_t) (s->position - c->last_pos)));
+    c->last_ts = s->timestamp_ns;
+    c->last_pos = s->position;
+    c->count++;
+}
+
+/**
+ * Moves a finished chunk into the write buffer and indexes it
+ */
+static int chunk_close(struct chunk *c, struct writer *w) {
+    uint8_t *p;
+    int ret;
+
+    if (c->count == 0) {
+        return 0;
+    }
+
+    if (w->len + CHUNK_HEADER_SIZE + c->size > WRITE_BUFFER || w->idx_len + 16 > sizeof(w->idx)) {
+        ret = writer_flush(w);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    put_u64(w->idx + w->idx_len, c->first_ts);
+    put_u64(w->idx + w->idx_len + 8, w->offset + w->len);
+    w->idx_len += 16;
+
+    p = w->buf + w->len;
+    put_u32(p, CHUNK_MAGIC);
+    put_u32(p + 4, c->flags);
+    put_u32(p + 8, c->count);
+    put_u32(p + 12, c->size);
+    put_u64(p + 16, c->first_ts);
+    put_u16(p + 24, c->first_pos);
+    put_u16(p + 26, 0);
+    memcpy(p + CHUNK_HEADER_SIZE, c->payload, c->size);
+    w->len += CHUNK_HEADER_SIZE + c->size;
+
+    c->flags = 0;
+    c->count = 0;
+    c->size = 0;
+    return 0;
+}
+
+static int open_log(const char *path, int index, struct writer *w) {
+    char idx_path[4096];
+    uint8_t header[LOG_HEADER_SIZE] = { 0 };
+
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        return -errno;
+    }
+    w->idx_fd = open(idx_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->idx_fd < 0) {
+        return -errno;
+    }
+
+    w->buf = malloc(WRITE_BUFFER);
+    if (!w->buf) {
+        return -ENOMEM;
+    }
+
+    memcpy(header, LOG_MAGIC, 8);
+    put_u32(header + 8, index);
+    memcpy(w->buf, header, sizeof(header));
+    w->len = sizeof(header);
+    return 0;
+}
+
+static int record(int index, const char *path, int flush_s) {
+    static struct motorknob_sample samples[HISTORY_BATCH];
+    static struct chunk chunk;
+    struct writer w = { 0 };
+    struct sigaction sa = { .sa_handler = on_signal };
+    struct mk_knob *knob;
+    struct pollfd pfd;
+    uint64_t since = 0, last_flush = now_ns(), total = 0, gaps = 0;
+    long was_enabled = 0;
+    uint32_t flags;
+    int ret, n, i;
+
+    knob = mk_open(index);
+    if (!knob) {
+        fprintf(stderr, "Cannot open knob%d: %s\n", index, strerror(errno));
+        return 1;
+    }
+
+    pfd.fd = mk_dev_fd(knob);
+    pfd.events = POLLIN;
+    if (pfd.fd < 0) {
+        fprintf(stderr, "Cannot open /dev/motorknob%d: %s\n", index, strerror(-pfd.fd));
+        return 1;
+    }
+
+    ret = open_log(path, index, &w);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", path, strerror(-ret));
+        return 1;
+    }
+
+    // no SA_RESTART, poll returns on a signal
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    mk_read_attr(knob, "sampler/enabled", &was_enabled);
+    mk_write_attr(knob, "sampler/enabled", 1);
+
+    while (!stop) {
+        ret = 0;
+        n = mk_history(knob, since, samples, HISTORY_BATCH, &flags);
+        if (n < 0) {
+            fprintf(stderr, "History of knob%d: %s\n", index, strerror(-n));
+            break;
+        }
+
+        if (n && (flags & MOTORKNOB_HISTORY_OVERRUN) && since) {
+            ret = chunk_close(&chunk, &w);
+            chunk.flags |= CHUNK_GAP;
+            gaps++;
+        }
+
+        for (i = 0; i < n && ret == 0; i++) {
+            chunk_add(&chunk, &samples[i]);
+            if (chunk.count == CHUNK_SAMPLES) {
+                ret = chunk_close(&chunk, &w);
+            }
+        }
+        if (n) {
+            since = samples[n - 1].timestamp_ns;
+            total += n;
+        }
+
+        if (ret == 0 && now_ns() - last_flush >= (uint64_t) flush_s * 1000000000ull) {
+            ret = chunk_close(&chunk, &w);
+            if (ret == 0) {
+                ret = writer_flush(&w);
+            }
+            last_flush = now_ns();
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Writing %s: %s\n", path, strerror(-ret));
+            break;
+        }
+
+        // more already waiting
+        if (n == HISTORY_BATCH) {
+            continue;
+        }
+        // a removed Knob polls as hung up right away, everything it had is written by now
+        if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+            fprintf(stderr, "knob%d is gone\n", index);
+            break;
+        }
+    }
+
+    ret = chunk_close(&chunk, &w);
+    if (ret == 0) {
+        ret = writer_flush(&w);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Writing %s: %s\n", path, strerror(-ret));
+    }
+
+    mk_write_attr(knob, "sampler/enabled", was_enabled);
+    mk_close(knob);
+
+    fprintf(stderr, "%llu samples, %llu bytes, %.2f bytes/sample, %llu gaps\n",
+            (unsigned long long) total, (unsigned long long) w.offset,
+            total ? (double) w.offset / total : 0.0, (unsigned long long) gaps);
+
+    close(w.fd);
+    close(w.idx_fd);
+    free(w.buf);
+    return ret < 0;
+}
+
+/**
+ * Offset of the last chunk starting at or before from_ns, using the index if there is one
+ */
+static long seek_offset(const char *path, uint64_t from_ns) {
+    char idx_path[4096];
+    uint8_t entry[16];
+    long offset = LOG_HEADER_SIZE;
+    FILE *idx;
+
+    if (!from_ns) {
+        return offset;
+    }
+
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    idx = fopen(idx_path, "rb");
+    if (!idx) {
+        return offset;
+    }
+
+    // entries are few (one per chunk), a linear pass is plenty
+    while (fread(entry, sizeof(entry), 1, idx) == 1 && get_u64(entry) <= from_ns) {
+        offset = get_u64(entry + 8);
+    }
+
+    fclose(idx);
+    return offset;
+}
+
+static int dump(const char *path, uint64_t from_ns, uint64_t to_ns, int raw) {
+    static uint8_t payload[CHUNK_SAMPLES * (10 + 3)];
+    uint8_t header[CHUNK_HEADER_SIZE];
+    FILE *f = fopen(path, "rb");
+    uint32_t index;
+
+    if (!f) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (fread(header, LOG_HEADER_SIZE, 1, f) != 1 || memcmp(header, LOG_MAGIC, 8)) {
+        fprintf(stderr, "%s is not a knob log\n", path);
+        fclose(f);
+        return 1;
+    }
+    index = get_u32(header + 8);
+
+    fseek(f, seek_offset(path, from_ns), SEEK_SET);
+
+    while (fread(header, CHUNK_HEADER_SIZE, 1, f) == 1) {
+        uint32_t count = get_u32(header + 8);
+        uint32_t size = get_u32(header + 12);
+        struct motorknob_sample s = {
+            .timestamp_ns = get_u64(header + 16),
+            .position = get_u16(header + 24),
+            .index = index,
+            .flags = MOTORKNOB_SAMPLE_VALID,
+        };
+        const uint8_t *p = payload, *end = payload + size;
+        uint32_t i;
+
+        if (get_u32(header) != CHUNK_MAGIC || size > sizeof(payload) || fread(payload, size, 1, f) != 1) {
+            break;
+        }
+        if (to_ns && s.timestamp_ns > to_ns) {
+            break;
+        }
+        if (!raw && (get_u32(header + 4) & CHUNK_GAP) && s.timestamp_ns >= from_ns) {
+            printf("# gap\n");
+        }
+
+        for (i = 0; i < count; i++) {
+            uint64_t dt, dp;
+            size_t n = get_varint(p, end, &dt);
+
+            if (!n) {
+                break;
+            }
+            p += n;
+            n = get_varint(p, end, &dp);
+            if (!n) {
+                break;
+            }
+            p += n;
+
+            s.timestamp_ns += dt;
+            s.position += unzigzag(dp);
+            if (s.timestamp_ns < from_ns) {
+                continue;
+            }
+            if (to_ns && s.timestamp_ns > to_ns) {
+                break;
+            }
+
+            if (raw) {
+                fwrite(&s, sizeof(s), 1, stdout);
+            } else {
+                printf("%llu %u\n", (unsigned long long) s.timestamp_ns, s.position);
+            }
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mk-log record <knob> <file> [flush seconds]\n"
+                    "       mk-log cat <file> [from_ns [to_ns]]\n"
+                    "       mk-log raw <file> [from_ns [to_ns]]\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && !strcmp(argv[1], "record")) {
+        return record(atoi(argv[2]), argv[3], argc > 4 ? atoi(argv[4]) : 5);
+    }
+
+    if (argc >= 3 && (!strcmp(argv[1], "cat") || !strcmp(argv[1], "raw"))) {
+        uint64_t from_ns = argc > 3 ? strtoull(argv[3], NULL, 0) : 0;
+        uint64_t to_ns = argc > 4 ? strtoull(argv[4], NULL, 0) : 0;
+
+        return dump(argv[2], from_ns, to_ns, !strcmp(argv[1], "raw"));
+    }
+
+    usage();
+    return 1;
+}
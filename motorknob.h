@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the MotorKnob driver
+ * Shared by the driver and everything talking to /dev/motorknob*
+ */
+#ifndef _UAPI_MOTORKNOB_H
+#define _UAPI_MOTORKNOB_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// Sample flags
+#define MOTORKNOB_SAMPLE_VALID (1 << 0) // position was read at least once
+
+/**
+ * One position of one Knob
+ * Timestamps are CLOCK_MONOTONIC
+ */
+struct motorknob_sample {
+    __u64 timestamp_ns;
+    __u16 position;
+    __u16 index;        // knobN in /sys/motorknob
+    __u32 flags;
+};
+
+// Snapshot flags
+#define MOTORKNOB_SNAPSHOT_FRESH (1 << 0) // read all Knobs now instead of returning cached positions
+
+/**
+ * Positions of all Knobs in one call
+ * count is the capacity of samples on the way in and the number of Knobs on the way out,
+ * which may be larger than what got copied
+ */
+struct motorknob_snapshot {
+    __u32 flags;
+    __u32 count;
+    __u64 samples; // struct motorknob_sample *
+};
+
+/**
+ * Fresh read at a given time, e.g. right before the next vblank
+ * Each Knob samples at_ns minus its sampler/trigger_offset_us, right away if
+ * that already passed. A new trigger replaces one that did not fire yet.
+ */
+struct motorknob_trigger {
+    __u64 at_ns;   // CLOCK_MONOTONIC, 0 for now
+    __u32 flags;   // must be 0
+    __u32 reserved;
+};
+
+/**
+ * Latest position, read from the Knob only if the known one is older than max_age_ns
+ */
+struct motorknob_position {
+    __u64 max_age_ns;
+    struct motorknob_sample sample; // out
+};
+
+/**
+ * Profile of one client, each open file of /dev/motorknobN has its own
+ * The Knob gets the profile of the file that has the focus.
+ */
+struct motorknob_context {
+    __u16 start_position;
+    __u16 end_position;
+    __u16 detents;
+    __u16 reserved;
+};
+
+/**
+ * One timed register write of a sequence
+ */
+struct motorknob_command {
+    __u64 at_ns;    // CLOCK_MONOTONIC
+    __u8 reg;       // MOTORKNOB_REG_*, profile or torque
+    __u8 reserved;
+    __u16 value;
+    __s32 result;   // out, 0 or -errno, -EINTR / -ENODEV if it did not run
+    __s64 error_ns; // out, how much later than at_ns the write started
+};
+
+/**
+ * Writes each command at its time, at_ns must not go backwards
+ * Returns once all ran, a signal cancels the commands not run yet.
+ */
+struct motorknob_sequence {
+    __u64 commands; // struct motorknob_command *, up to 4096
+    __u32 count;
+    __u32 flags;    // must be 0
+};
+
+// History flags
+#define MOTORKNOB_HISTORY_OVERRUN (1 << 0) // samples newer than since_ns were already overwritten
+
+/**
+ * Recent positions of one Knob, oldest first
+ * Returns the oldest count samples newer than since_ns, so calling again
+ * with the timestamp of the last one continues without gaps.
+ * since_ns 0 means everything still in the ring.
+ */
+struct motorknob_history {
+    __u64 since_ns;
+    __u32 count;    // capacity of samples in, copied out
+    __u32 flags;    // out
+    __u64 samples;  // struct motorknob_sample *
+};
+
+// Zone flags, which transitions are reported
+#define MOTORKNOB_ZONE_ENTER (1 << 0)
+#define MOTORKNOB_ZONE_EXIT  (1 << 1)
+
+#define MOTORKNOB_ZONES_MAX 32
+
+/**
+ * Position range low..high, both included
+ * low > high wraps around 0xffff
+ */
+struct motorknob_zone {
+    __u16 low;
+    __u16 high;
+    __u32 flags;   // MOTORKNOB_ZONE_ENTER and/or MOTORKNOB_ZONE_EXIT
+};
+
+/**
+ * Zones of one open file, replaces the previous ones, count 0 removes them
+ * inside tells which zones the latest position is in, so waiting for
+ * "past 80%" cannot miss that it already is.
+ */
+struct motorknob_zones {
+    __u64 zones;   // struct motorknob_zone *
+    __u32 count;
+    __u32 inside;  // out, bit per zone
+    __s32 eventfd; // signaled on every event, -1 for none
+    __u32 flags;   // must be 0
+};
+
+// Zone event flags, besides MOTORKNOB_ZONE_ENTER / MOTORKNOB_ZONE_EXIT
+#define MOTORKNOB_ZONE_OVERRUN (1 << 7) // older events were dropped before this one
+
+/**
+ * What read() on /dev/motorknobN returns once zones are set
+ */
+struct motorknob_zone_event {
+    __u64 timestamp_ns; // of the sample that crossed
+    __u16 position;
+    __u8 zone;
+    __u8 flags;
+    __u32 inside;       // zones the position is in after this sample
+};
+
+// Registers for register operations
+#define MOTORKNOB_REG_START_POS   0x00
+#define MOTORKNOB_REG_END_POS     0x01
+#define MOTORKNOB_REG_DETENTS     0x02
+#define MOTORKNOB_REG_CURRENT_POS 0x03 // read only
+#define MOTORKNOB_REG_TORQUE      0x04 // write only
+#define MOTORKNOB_REG_CAPS        0x05 // read only
+
+// Op flags
+#define MOTORKNOB_OP_WRITE (1 << 0)
+
+/**
+ * One register read or write of a batch
+ */
+struct motorknob_op {
+    __u8 reg;
+    __u8 flags;
+    __u16 value;   // written, or what was read
+    __s32 result;  // out, 0 or -errno
+};
+
+/**
+ * Batch of register operations, sits in the command area of an
+ * IORING_OP_URING_CMD SQE (fits a normal 64 byte SQE)
+ */
+struct motorknob_uring_batch {
+    __u64 ops;     // struct motorknob_op *
+    __u32 count;
+    __u32 flags;   // must be 0
+};
+
+#define MOTORKNOB_IOC_MAGIC 'K'
+
+// /dev/motorknob
+#define MOTORKNOB_IOC_SNAPSHOT _IOWR(MOTORKNOB_IOC_MAGIC, 0x01, struct motorknob_snapshot)
+#define MOTORKNOB_IOC_TRIGGER_ALL _IOW(MOTORKNOB_IOC_MAGIC, 0x02, struct motorknob_trigger)
+
+// /dev/motorknobN
+#define MOTORKNOB_IOC_HISTORY _IOWR(MOTORKNOB_IOC_MAGIC, 0x10, struct motorknob_history)
+#define MOTORKNOB_IOC_ZONES _IOWR(MOTORKNOB_IOC_MAGIC, 0x11, struct motorknob_zones)
+#define MOTORKNOB_IOC_TRIGGER _IOW(MOTORKNOB_IOC_MAGIC, 0x12, struct motorknob_trigger)
+#define MOTORKNOB_IOC_POSITION _IOWR(MOTORKNOB_IOC_MAGIC, 0x13, struct motorknob_position)
+#define MOTORKNOB_IOC_CONTEXT _IOW(MOTORKNOB_IOC_MAGIC, 0x14, struct motorknob_context)
+#define MOTORKNOB_IOC_FOCUS _IO(MOTORKNOB_IOC_MAGIC, 0x15)
+#define MOTORKNOB_IOC_SEQUENCE _IOW(MOTORKNOB_IOC_MAGIC, 0x16, struct motorknob_sequence)
+
+// /dev/motorknobN, cmd_op of IORING_OP_URING_CMD
+#define MOTORKNOB_URING_CMD_BATCH _IOWR(MOTORKNOB_IOC_MAGIC, 0x20, struct motorknob_uring_batch)
+
+#endif
@@ -0,0 +1,341 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+#include <linux/regmap.h>
+#endif
+
+/*
+ * Register access microbenchmark
+ * Measures the primitives the driver could use for its hot paths against a Knob
+ * or i2c-stub. Runs once when loaded and prints to the kernel log, reload to run again.
+ */
+
+// Module Metadata
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lukas Sturm");
+MODULE_DESCRIPTION("Benchmarks SMBus word, block, i2c_transfer and regmap access to a Motorknob");
+MODULE_VERSION("0.2");
+
+static int bus = -1;
+module_param(bus, int, 0444);
+MODULE_PARM_DESC(bus, "i2c bus number of the Knob");
+
+static unsigned short addr = 0x55;
+module_param(addr, ushort, 0444);
+MODULE_PARM_DESC(addr, "i2c address of the Knob (default 0x55)");
+
+static unsigned int iterations = 1000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Operations per variant (default 1000)");
+
+static bool writes;
+module_param(writes, bool, 0444);
+MODULE_PARM_DESC(writes, "Also benchmark writes, writing back the profile read at start (default off)");
+
+// Same register layout as motorknob_driver.c
+#define WRITE_REQUEST    0b10000000
+#define DATA_START_POS   0b00000000
+#define DATA_CURRENT_POS 0b00000011
+
+// start, end, detents and position are adjacent, one word each
+#define BENCH_REGISTERS 4
+#define BENCH_PROFILE   3
+
+struct bench_ctx {
+    struct i2c_adapter *adapter;
+    u8 regs[BENCH_REGISTERS * 2]; // little endian, as on the wire
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+    struct i2c_client *dummy;
+    struct regmap *map;
+#endif
+};
+
+struct bench_case {
+    const char *name;
+    u32 func;       // adapter functionality needed
+    bool write;
+    bool regmap;
+    int registers;  // registers moved per operation
+    int (*op)(struct bench_ctx *ctx);
+};
+
+static s32 bench_smbus(struct bench_ctx *ctx, char read_write, u8 reg, int size, union i2c_smbus_data *data) {
+    return i2c_smbus_xfer(ctx->adapter, addr, 0, read_write, reg, size, data);
+}
+
+static int bench_word_position(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+    return bench_smbus(ctx, I2C_SMBUS_READ, DATA_CURRENT_POS, I2C_SMBUS_WORD_DATA, &data);
+}
+
+static int bench_word_all(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+    int i;
+
+    for (i = 0; i < BENCH_REGISTERS; i++) {
+        s32 ret = bench_smbus(ctx, I2C_SMBUS_READ, DATA_START_POS + i, I2C_SMBUS_WORD_DATA, &data);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int bench_block_all(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+
+    data.block[0] = BENCH_REGISTERS * 2;
+    return bench_smbus(ctx, I2C_SMBUS_READ, DATA_START_POS, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+}
+
+/**
+ * Register pointer write and read in one combined transfer, repeated start in between
+ */
+static int bench_transfer_read(struct bench_ctx *ctx, u8 reg, u8 *buf, u16 len) {
+    struct i2c_msg msgs[] = {
+        { .addr = addr, .flags = 0, .len = 1, .buf = &reg },
+        { .addr = addr, .flags = I2C_M_RD, .len = len, .buf = buf },
+    };
+    int ret = i2c_transfer(ctx->adapter, msgs, ARRAY_SIZE(msgs));
+
+    if (ret < 0) {
+        return ret;
+    }
+    return ret == ARRAY_SIZE(msgs) ? 0 : -EIO;
+}
+
+static int bench_transfer_position(struct bench_ctx *ctx) {
+    u8 buf[2];
+    return bench_transfer_read(ctx, DATA_CURRENT_POS, buf, sizeof(buf));
+}
+
+static int bench_transfer_all(struct bench_ctx *ctx) {
+    u8 buf[BENCH_REGISTERS * 2];
+    return bench_transfer_read(ctx, DATA_START_POS, buf, sizeof(buf));
+}
+
+static int bench_word_write(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+    int i;
+
+    for (i = 0; i < BENCH_PROFILE; i++) {
+        s32 ret;
+
+        data.word = ctx->regs[2 * i] | (ctx->regs[2 * i + 1] << 8);
+        ret = bench_smbus(ctx, I2C_SMBUS_WRITE, WRITE_REQUEST | (DATA_START_POS + i), I2C_SMBUS_WORD_DATA, &data);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int bench_block_write(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+
+    data.block[0] = BENCH_PROFILE * 2;
+    memcpy(&data.block[1], ctx->regs, BENCH_PROFILE * 2);
+    return bench_smbus(ctx, I2C_SMBUS_WRITE, WRITE_REQUEST | DATA_START_POS, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+}
+
+static int bench_transfer_write(struct bench_ctx *ctx) {
+    u8 buf[1 + BENCH_PROFILE * 2];
+    struct i2c_msg msg = { .addr = addr, .flags = 0, .len = sizeof(buf), .buf = buf };
+    int ret;
+
+    buf[0] = WRITE_REQUEST | DATA_START_POS;
+    memcpy(&buf[1], ctx->regs, BENCH_PROFILE * 2);
+    ret = i2c_transfer(ctx->adapter, &msg, 1);
+    if (ret < 0) {
+        return ret;
+    }
+    return ret == 1 ? 0 : -EIO;
+}
+
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+static const struct regmap_config bench_regmap_config = {
+    .reg_bits = 8,
+    .val_bits = 16,
+    .val_format_endian = REGMAP_ENDIAN_LITTLE,
+    .write_flag_mask = WRITE_REQUEST,
+    .max_register = DATA_CURRENT_POS,
+    .cache_type = REGCACHE_NONE,
+};
+
+static int bench_regmap_position(struct bench_ctx *ctx) {
+    unsigned int val;
+    return regmap_read(ctx->map, DATA_CURRENT_POS, &val);
+}
+
+static int bench_regmap_all(struct bench_ctx *ctx) {
+    u16 vals[BENCH_REGISTERS];
+    return regmap_bulk_read(ctx->map, DATA_START_POS, vals, BENCH_REGISTERS);
+}
+
+static int bench_regmap_write(struct bench_ctx *ctx) {
+    u16 vals[BENCH_PROFILE];
+    int i;
+
+    for (i = 0; i < BENCH_PROFILE; i++) {
+        vals[i] = ctx->regs[2 * i] | (ctx->regs[2 * i + 1] << 8);
+    }
+    return regmap_bulk_write(ctx->map, DATA_START_POS, vals, BENCH_PROFILE);
+}
+#endif
+
+static const struct bench_case bench_cases[] = {
+    { "word position",        I2C_FUNC_SMBUS_READ_WORD_DATA,   false, false, 1, bench_word_position },
+    { "i2c_transfer position", I2C_FUNC_I2C,                   false, false, 1, bench_transfer_position },
+    { "word x4",              I2C_FUNC_SMBUS_READ_WORD_DATA,   false, false, BENCH_REGISTERS, bench_word_all },
+    { "block x4",             I2C_FUNC_SMBUS_READ_I2C_BLOCK,   false, false, BENCH_REGISTERS, bench_block_all },
+    { "i2c_transfer x4",      I2C_FUNC_I2C,                    false, false, BENCH_REGISTERS, bench_transfer_all },
+    { "word write x3",        I2C_FUNC_SMBUS_WRITE_WORD_DATA,  true,  false, BENCH_PROFILE, bench_word_write },
+    { "block write x3",       I2C_FUNC_SMBUS_WRITE_I2C_BLOCK,  true,  false, BENCH_PROFILE, bench_block_write },
+    { "i2c_transfer write x3", I2C_FUNC_I2C,                   true,  false, BENCH_PROFILE, bench_transfer_write },
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+    { "regmap position",      0,                               false, true,  1, bench_regmap_position },
+    { "regmap bulk x4",       0,                               false, true,  BENCH_REGISTERS, bench_regmap_all },
+    { "regmap bulk write x3", 0,                               true,  true,  BENCH_PROFILE, bench_regmap_write },
+#endif
+};
+
+static int bench_cmp(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_run(struct bench_ctx *ctx, const struct bench_case *bc, u64 *lat) {
+    u64 start, total;
+    unsigned int i;
+    int ret;
+
+    if (bc->func && !i2c_check_functionality(ctx->adapter, bc->func)) {
+        pr_info("motorknob-bench - %-22s not supported by adapter\n", bc->name);
+        return;
+    }
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+    if (bc->regmap && !ctx->map) {
+        pr_info("motorknob-bench - %-22s skipped, address is bound to a driver\n", bc->name);
+        return;
+    }
+#endif
+
+    start = ktime_get_ns();
+    for (i = 0; i < iterations; i++) {
+        u64 t = ktime_get_ns();
+
+        ret = bc->op(ctx);
+        lat[i] = ktime_get_ns() - t;
+        if (ret < 0) {
+            pr_info("motorknob-bench - %-22s failed after %u ops: %d\n", bc->name, i, ret);
+            return;
+        }
+    }
+    total = max_t(u64, ktime_get_ns() - start, 1);
+
+    sort(lat, iterations, sizeof(*lat), bench_cmp, NULL);
+    pr_info("motorknob-bench - %-22s %7llu ops/s %7llu regs/s  min %6llu  p50 %6llu  p99 %6llu  max %6llu ns\n",
+            bc->name,
+            div64_u64((u64)iterations * NSEC_PER_SEC, total),
+            div64_u64((u64)iterations * bc->registers * NSEC_PER_SEC, total),
+            lat[0], lat[iterations / 2], lat[iterations - 1 - iterations / 100], lat[iterations - 1]);
+}
+
+/**
+ * Reads the profile once, so write variants write back what is already there
+ */
+static int bench_prepare(struct bench_ctx *ctx) {
+    union i2c_smbus_data data;
+    int i;
+
+    for (i = 0; i < BENCH_REGISTERS; i++) {
+        s32 ret = bench_smbus(ctx, I2C_SMBUS_READ, DATA_START_POS + i, I2C_SMBUS_WORD_DATA, &data);
+        if (ret < 0) {
+            return ret;
+        }
+        ctx->regs[2 * i] = data.word & 0xFF;
+        ctx->regs[2 * i + 1] = data.word >> 8;
+    }
+
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+    // fails with -EBUSY while motorknob_driver is bound, regmap is skipped then
+    ctx->dummy = i2c_new_dummy_device(ctx->adapter, addr);
+    if (IS_ERR(ctx->dummy)) {
+        ctx->dummy = NULL;
+        return 0;
+    }
+    ctx->map = regmap_init_i2c(ctx->dummy, &bench_regmap_config);
+    if (IS_ERR(ctx->map)) {
+        ctx->map = NULL;
+    }
+#endif
+    return 0;
+}
+
+static void bench_cleanup(struct bench_ctx *ctx) {
+#if IS_ENABLED(CONFIG_REGMAP_I2C)
+    if (ctx->map) {
+        regmap_exit(ctx->map);
+    }
+    i2c_unregister_device(ctx->dummy);
+#endif
+}
+
+static int __init motorknob_bench_init(void) {
+    struct bench_ctx ctx = {};
+    u64 *lat;
+    int i, ret;
+
+    if (bus < 0 || !iterations) {
+        pr_err("motorknob-bench - bus= and iterations= are required\n");
+        return -EINVAL;
+    }
+
+    ctx.adapter = i2c_get_adapter(bus);
+    if (!ctx.adapter) {
+        pr_err("motorknob-bench - no i2c bus %d\n", bus);
+        return -ENODEV;
+    }
+
+    lat = kvmalloc_array(iterations, sizeof(*lat), GFP_KERNEL);
+    if (!lat) {
+        ret = -ENOMEM;
+        goto put_adapter;
+    }
+
+    ret = bench_prepare(&ctx);
+    if (ret < 0) {
+        pr_err("motorknob-bench - no Knob at %d-%04x: %d\n", bus, addr, ret);
+        goto free_lat;
+    }
+
+    pr_info("motorknob-bench - %s, %d-%04x, %u ops per variant\n", ctx.adapter->name, bus, addr, iterations);
+    for (i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+        if (bench_cases[i].write && !writes) {
+            continue;
+        }
+        bench_run(&ctx, &bench_cases[i], lat);
+        cond_resched();
+    }
+    ret = 0;
+
+    bench_cleanup(&ctx);
+free_lat:
+    kvfree(lat);
+put_adapter:
+    i2c_put_adapter(ctx.adapter);
+    return ret;
+}
+
+static void __exit motorknob_bench_exit(void) {
+}
+
+module_init(motorknob_bench_init);
+module_exit(motorknob_bench_exit);
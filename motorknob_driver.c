@@ -3,12 +3,54 @@
 #include <linux/i2c.h>
 #include <linux/proc_fs.h>
 #include <linux/kobject.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/hid.h>
+#include <linux/interrupt.h>
+#include <linux/atomic.h>
+#include <linux/idr.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/list_sort.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/version.h>
+#include <linux/eventfd.h>
+#include <linux/crc32.h>
+#include <linux/rwsem.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+
+#include "motorknob.h"
+
+#define CREATE_TRACE_POINTS
+#include "motorknob_trace.h"
 
 // Module Metadata
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Lukas Sturm");
 MODULE_DESCRIPTION("Manages a Motorknob, a Motor powered Input device");
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
+
+static unsigned int history_size = 4096;
+module_param(history_size, uint, 0444);
+MODULE_PARM_DESC(history_size, "Samples kept per Knob for late joiners, rounded up to a power of two (default 4096)");
+
+#define HISTORY_COPY_CHUNK 256 // samples copied per seqlock read section
 
 // Command Structure
 #define WRITE_REQUEST 0b10000000
@@ -17,172 +59,4623 @@ MODULE_VERSION("0.1");
 #define DATA_END_POS     0b00000001
 #define DATA_DETENTS     0b00000010
 #define DATA_CURRENT_POS 0b00000011
+#define DATA_TORQUE      0b00000100 // write only, signed torque command
+#define DATA_CAPS        0b00000101 // read only, firmware capabilities
+#define DATA_DELTA       0b00000110 // read only, signed motion since the last read, cleared by reading
+
+// Capabilities
+#define CAP_PEC   BIT(0) // understands SMBus Packet Error Checking
+#define CAP_DELTA BIT(1) // has DATA_DELTA
+#define CAP_BLOCK BIT(2) // i2c block transfers auto increment the register
+#define CAP_KNOWN (CAP_PEC | CAP_DELTA | CAP_BLOCK) // the rest is reserved and reads 0
 
 #define WRITE_START_POS (WRITE_REQUEST | DATA_START_POS)
 #define WRITE_END_POS   (WRITE_REQUEST | DATA_END_POS)
 #define WRITE_DETENTS   (WRITE_REQUEST | DATA_DETENTS)
+#define WRITE_TORQUE    (WRITE_REQUEST | DATA_TORQUE)
+
+// last values written to / read from the profile registers, indexed by register
+#define PROFILE_REGISTERS (DATA_DETENTS + 1)
+
+/*
+ * Readers in the sampling path (control loop, IRQ thread) never lock the profile.
+ * It is never changed in place, writers publish a new copy once the Knob took the values.
+ */
+struct motorknob_profile {
+    struct rcu_head rcu;
+    u16 values[PROFILE_REGISTERS];
+    u8 valid; // BIT(reg) once the value is known
+};
+
+/*
+ * Scrubbing
+ * A low priority work item reads the profile back every interval_ms and
+ * repairs registers that no longer match the cache. It never uses more
+ * than budget_us of bus time per second, a slow bus just scrubs less often.
+ */
+#define SCRUB_INTERVAL_DEFAULT 10000 // ms
+#define SCRUB_BUDGET_DEFAULT   1000  // us per second
+
+struct motorknob_scrub {
+    struct delayed_work work;
+    unsigned int interval_ms; // 0 disables
+    unsigned int budget_us;
+
+    // only touched by the work item
+    u64 runs;
+    u64 mismatches;
+    u64 repairs;
+    u64 errors;
+    u64 last_bus_us;
+};
+
+/*
+ * Request queue
+ * On demand register reads and writes queue up here. The first caller waits
+ * window_us for others to join, then transfers everything queued by then.
+ * Requests for adjacent registers merge into one i2c block transfer if the
+ * firmware can (CAP_BLOCK), writes go out before reads.
+ */
+#define QUEUE_WINDOW_DEFAULT 0     // us, a lone request must not pay for a window
+#define QUEUE_WINDOW_MAX     10000 // us
+#define QUEUE_RUN_MAX        (I2C_SMBUS_BLOCK_MAX / 2) // registers per block transfer
+
+struct motorknob_request {
+    struct list_head node;
+    u8 reg;   // without WRITE_REQUEST
+    bool write;
+    u16 word; // in for writes, out for reads
+    s32 result;
+    atomic_t *pending; // requests of the same submit not done yet
+};
+
+struct motorknob_queue {
+    spinlock_t lock;
+    struct list_head pending;
+    bool busy; // a caller is transferring the queue
+    wait_queue_head_t wait;
+    unsigned int window_us;
+    unsigned int uring_inflight; // io_uring batches not yet transferred, under lock
+
+    // under lock, shown in debugfs
+    u64 requests;
+    u64 transfers;
+    u64 block_transfers;
+    u64 block_fallbacks;
+    u64 batches;
+    u64 max_batch;
+
+    // on demand position reads
+    u64 position_cached; // fresh enough without the bus
+    u64 position_shared; // took the result of a read that finished while waiting
+    u64 position_reads;
+};
+
+/*
+ * Packet Error Checking
+ * Writes always use PEC if both sides can do it, profile reads too.
+ * Position reads run at the sample rate, there it is a policy:
+ * off, on or auto. Auto probes every PEC_PROBE_INTERVAL-th read with PEC
+ * and keeps it on for PEC_HOLD reads once a checksum failed anywhere.
+ */
+#define PEC_PROBE_INTERVAL 64
+#define PEC_HOLD           10000
+
+enum motorknob_pec_policy {
+    PEC_OFF,
+    PEC_ON,
+    PEC_AUTO,
+};
+
+static const char * const pec_policy_names[] = {
+    [PEC_OFF] = "off",
+    [PEC_ON] = "on",
+    [PEC_AUTO] = "auto",
+};
+
+struct motorknob_pec {
+    bool available;
+    enum motorknob_pec_policy position_policy;
+    // sampler, queue and interrupt all read positions
+    atomic_t auto_count;
+    atomic_t auto_hold;
+
+    atomic64_t read_errors;
+    atomic64_t write_errors;
+    atomic64_t transactions; // with PEC
+};
+
+/*
+ * Sampler
+ * A hrtimer ticks at the sample rate and queues the Knob on its bus,
+ * whose realtime thread does the actual bus transfers (i2c may sleep, timers may not).
+ * Everything that needs fresh positions hooks in here.
+ */
+#define SAMPLE_RATE_DEFAULT 1000
+#define SAMPLE_RATE_MAX     5000
+#define TRIGGER_OFFSET_MAX  100000 // us
+#define REBASE_TRIES        8      // Knob still moving after that, switching to relative fails with EBUSY
+
+// hrtimer_setup replaced hrtimer_init in 6.13
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define motorknob_hrtimer_setup(timer, fn, mode) hrtimer_setup(timer, fn, CLOCK_MONOTONIC, mode)
+#else
+#define motorknob_hrtimer_setup(timer, fn, mode) \
+    do { \
+        hrtimer_init(timer, CLOCK_MONOTONIC, mode); \
+        (timer)->function = fn; \
+    } while (0)
+#endif
+
+struct motorknob_bus;
+
+struct motorknob_sampler {
+    struct hrtimer timer;
+    struct motorknob_bus *bus;
+    struct mutex lock; // protects users and stopped
+    int users;
+    bool forced; // sampler/enabled
+    bool stopped; // Knob is going away, no more triggers
+    ktime_t period;
+
+    // one shot for external triggers
+    struct hrtimer trigger;
+    unsigned int trigger_offset_us;
+    s32 velocity; // position units per sample, only written by the thread
+
+    // position the sampler last saw, relative reads add to it, under mk->sample_mutex
+    // its own so that reads published from elsewhere never count motion twice
+    u16 base;
+    bool base_valid;
+
+    // under bus->lock
+    struct list_head due_node;
+    bool due;
+    bool due_periodic; // queued by a tick, not by a trigger or a link
+    ktime_t due_time; // expiry of the tick or trigger that queued it
+
+    // loop period jitter and tick to sample latency, only written by the thread
+    spinlock_t stats_lock;
+    ktime_t last_start;
+    u64 loops;
+    u64 overruns;
+    s64 jitter_min;
+    s64 jitter_max;
+    u64 jitter_abs_sum;
+    u64 latency_count;
+    u64 latency_max;
+    u64 latency_sum;
+    // reads out of the loop, kept apart so they do not skew the above
+    u64 triggered_count;
+    u64 triggered_max;
+    u64 triggered_sum;
+};
+
+/*
+ * Bus
+ * All Knobs behind one root adapter share a sampler thread. Behind an i2c mux
+ * every channel is its own adapter and switching channels costs a transaction,
+ * so the thread samples every due Knob on the current channel before switching.
+ * Timers tick aligned to the period, so Knobs with the same rate are due together.
+ * After CHANNEL_STREAK_MAX samples in a row on one channel the Knob queued first
+ * goes next, a channel that is always due must not starve the others.
+ */
+#define CHANNEL_STREAK_MAX 16
+
+struct motorknob_bus {
+    struct list_head node; // in motorknob_buses
+    struct i2c_adapter *root;
+    int knobs;             // under motorknob_buses_lock
+    struct task_struct *thread;
+
+    spinlock_t lock;       // taken from the timers
+    struct list_head due;  // samplers waiting for the thread
+    struct motorknob_sampler *active; // being sampled right now
+    wait_queue_head_t idle;
+
+    // only written by the thread
+    struct i2c_adapter *channel; // adapter of the last sampled Knob
+    unsigned int channel_streak; // samples in a row on it
+    u64 channel_switches;
+    u64 samples;
+};
+
+/*
+ * Closed loop haptic controller
+ * Runs once per sample and writes a torque computed from the cached
+ * position and profile. Gains are fixed point with 8 fractional bits.
+ */
+struct motorknob_control {
+    bool enabled;
+    int wall_stiffness;   // torque per position unit past start/end
+    int friction;         // constant torque against the direction of motion
+    int spring_stiffness; // torque per position unit away from spring_center
+    int spring_center;
+    int torque_limit;
+};
+
+/*
+ * Linking
+ * A Knob can drive another one: every position change sets the spring
+ * center of the target's control loop to position * ratio + offset and
+ * samples the target right away instead of on its next tick, so the
+ * target's torque follows within one bus transfer.
+ */
+#define LINK_RATIO_ONE 256 // 8 fractional bits like the control gains
+// anything beyond maps a step of the source past the whole range of the target
+#define LINK_RATIO_MAX  (U16_MAX * LINK_RATIO_ONE)
+#define LINK_OFFSET_MAX U16_MAX
+
+struct motorknob;
+
+struct motorknob_link {
+    struct motorknob __rcu *target; // holds a kobject reference, changed under motorknob_devices_lock
+    int ratio;
+    int offset;
+
+    // as a target: source sample time of the newest setpoint not acted on yet
+    atomic64_t pending_ns;
+    // source sample until the target wrote a torque for it
+    spinlock_t stats_lock;
+    u64 latency_count;
+    u64 latency_max;
+    u64 latency_sum;
+};
+
+/*
+ * Virtual knobs
+ * Up to VIRTUAL_KNOBS modes share one Knob, each with its own profile and
+ * position. The position of the active one is the Knob's plus offset, its
+ * profile gets written shifted by the offset, so walls and detents stay where
+ * the virtual knob had them.
+ */
+#define VIRTUAL_KNOBS 8
+
+struct motorknob_vknob {
+    bool valid;
+    u16 start;
+    u16 end;
+    u16 detents;
+    u16 position; // where it was left, while inactive
+};
+
+struct motorknob_virtual {
+    struct motorknob_vknob knobs[VIRTUAL_KNOBS];
+    int active;  // -1 for none, the Knob's own positions
+    u16 offset;  // virtual minus Knob position of the active one
+    u16 own[PROFILE_REGISTERS]; // the Knob's own profile while one is active
+};
+
+/*
+ * One Knob
+ * Lives as long as its kobject /sys/motorknob/knobN
+ */
+struct motorknob {
+    struct kobject kobj;
+    struct i2c_client *client;
+    struct list_head node; // in motorknob_devices
+    int index;
+    struct mutex lock;     // serialises configuration changes
+    u16 caps;
+
+    // relative mode samples DATA_DELTA, nothing gets lost between samples
+    bool relative;
+    s64 accumulated;       // total motion, only written by the sampler
+
+    // what the profile registers should contain, replaced as a whole under profile_lock
+    struct mutex profile_lock; // profile writes vs scrubbing
+    struct motorknob_profile __rcu *profile;
+    struct motorknob_scrub scrub;
+
+    struct motorknob_queue queue;
+    struct dentry *debugfs; // /sys/kernel/debug/motorknob/knobN
+
+    // latest position, from the sampler or an on demand read
+    // the lock also covers the history ring
+    seqlock_t sample_lock;
+    struct motorknob_sample sample;
+    struct mutex position_lock; // one on demand position read at a time
+    unsigned int max_age_us;    // position attribute
+
+    // ring of recent samples, history_head counts all samples ever pushed
+    struct motorknob_sample *history;
+    unsigned int history_mask;
+    u64 history_head;
+    u64 history_dropped_ns; // timestamp of the newest sample the ring overwrote
+    wait_queue_head_t history_wait;
+
+    // files with zones, evaluated on every published sample
+    spinlock_t zone_lock;
+    struct list_head zone_files;
+
+    struct motorknob_pec pec;
+    struct mutex sample_mutex; // one sample at a time, sampler vs interrupt
+    struct motorknob_sampler sampler;
+
+    // optional data ready interrupt, 0 without
+    int irq;
+    ktime_t irq_time; // taken in hard irq context
+    struct motorknob_control control;
+    struct motorknob_link link;
+    struct motorknob_virtual virt; // under lock
+
+    struct hid_device *hid;
+    struct mutex hid_lock; // keeps the device alive while reporting
+
+    struct work_struct snapshot_work;
+    struct completion *snapshot_done;
+
+    // /dev/motorknobN
+    struct miscdevice miscdev;
+    char miscdev_name[16];
+    bool gone; // removed while files were still open
+    struct rw_semaphore file_io; // files talking to the Knob vs gone
+
+    // the file whose profile context the Knob has, under lock
+    struct motorknob_file *focus;
+    u64 context_switches;
+    u64 context_skipped; // the Knob had that profile already
+
+    struct list_head sequences; // running sequences, under queue.lock
+};
+
+/*
+ * Zones
+ * A file can watch position ranges and only hears from the driver when the
+ * Knob enters or leaves one, instead of following every sample.
+ */
+#define ZONE_EVENTS 64 // undelivered events per file, the oldest get dropped
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define motorknob_eventfd_signal(ctx) eventfd_signal(ctx)
+#else
+#define motorknob_eventfd_signal(ctx) eventfd_signal(ctx, 1)
+#endif
+
+struct motorknob_file_zones {
+    struct motorknob_zone zones[MOTORKNOB_ZONES_MAX];
+    u32 count;
+    u32 inside; // bit per zone the latest position is in
+    u64 seq;    // history_head of the sample inside is from
+    struct motorknob_zone_event events[ZONE_EVENTS];
+    unsigned int head, tail;
+    bool overrun;
+    struct eventfd_ctx *eventfd;
+};
+
+// per open file of /dev/motorknobN
+struct motorknob_file {
+    struct motorknob *mk;
+    u64 history_seen; // history_head at the last history call
+
+    // under mk->zone_lock, in mk->zone_files while zones is set
+    struct motorknob_file_zones *zones;
+    struct list_head zone_node;
+    wait_queue_head_t zone_wait;
+
+    // under mk->lock
+    struct motorknob_context context;
+    bool has_context;
+};
+
+#define to_motorknob(_kobj) container_of(_kobj, struct motorknob, kobj)
 
 // sysfs
 // static struct proc_dir_entry *proc_file;
 static struct kobject *motorknob_kobj;
-static struct kobject *motorknob_profile_kobj;
+static struct kset *motorknob_kset; // so Knobs can send uevents
+
+// /sys/kernel/debug/motorknob
+static struct dentry *motorknob_debugfs;
+
+// all probed Knobs
+static LIST_HEAD(motorknob_devices);
+static DEFINE_MUTEX(motorknob_devices_lock);
+static DEFINE_IDA(motorknob_ida);
+
+// sampler threads, one per root adapter
+static LIST_HEAD(motorknob_buses);
+static DEFINE_MUTEX(motorknob_buses_lock);
+
+/**
+ * Fills new from the current profile plus the registers in mask and publishes it
+ * Values read (seed) only fill in unknown registers, what was written stays authoritative
+ * Caller holds profile_lock, new is consumed
+ * Returns the registers whose value changed
+ */
+static unsigned long motorknob_profile_publish(struct motorknob *mk, struct motorknob_profile *new,
+                                               const u16 *values, unsigned long mask, bool seed) {
+    struct motorknob_profile *old = rcu_dereference_protected(mk->profile, lockdep_is_held(&mk->profile_lock));
+    unsigned long changed = 0;
+    unsigned int reg;
+
+    for_each_set_bit(reg, &mask, PROFILE_REGISTERS) {
+        bool known = old->valid & BIT(reg);
+
+        if ((seed && known) || (known && old->values[reg] == values[reg])) {
+            continue;
+        }
+        changed |= BIT(reg);
+    }
+
+    if (!changed) {
+        kfree(new);
+        return 0;
+    }
+
+    *new = *old;
+    for_each_set_bit(reg, &changed, PROFILE_REGISTERS) {
+        new->values[reg] = values[reg];
+        new->valid |= BIT(reg);
+    }
+
+    rcu_assign_pointer(mk->profile, new);
+    kfree_rcu(old, rcu);
+    return changed;
+}
+
+/**
+ * Whether the driver knows what a profile register contains
+ */
+static bool motorknob_profile_known(struct motorknob *mk, u8 reg) {
+    bool known;
+
+    rcu_read_lock();
+    known = rcu_dereference(mk->profile)->valid & BIT(reg);
+    rcu_read_unlock();
+    return known;
+}
+
+static const char * const profile_attr_names[PROFILE_REGISTERS] = {
+    [DATA_START_POS] = "start_position",
+    [DATA_END_POS] = "end_position",
+    [DATA_DETENTS] = "detents",
+};
+
+/**
+ * Tells userspace which profile registers got a new value
+ * One KOBJ_CHANGE uevent listing them, e.g. MOTORKNOB_PROFILE=start_position,detents,
+ * and a poll wakeup on each changed file in profile/
+ */
+static void motorknob_profile_changed(struct motorknob *mk, unsigned long changed) {
+    char env[64];
+    char *envp[] = { env, NULL };
+    const char *sep = "";
+    unsigned int reg;
+    int len;
+
+    if (!changed) {
+        return;
+    }
+
+    len = scnprintf(env, sizeof(env), "MOTORKNOB_PROFILE=");
+    for_each_set_bit(reg, &changed, PROFILE_REGISTERS) {
+        len += scnprintf(env + len, sizeof(env) - len, "%s%s", sep, profile_attr_names[reg]);
+        sep = ",";
+        sysfs_notify(&mk->kobj, "profile", profile_attr_names[reg]);
+    }
+
+    kobject_uevent_env(&mk->kobj, KOBJ_CHANGE, envp);
+}
+
+static bool zone_contains(const struct motorknob_zone *zone, u16 position) {
+    if (zone->low <= zone->high) {
+        return position >= zone->low && position <= zone->high;
+    }
+    return position >= zone->low || position <= zone->high;
+}
+
+static u32 zones_inside(const struct motorknob_file_zones *z, u16 position) {
+    u32 inside = 0;
+    u32 i;
+
+    for (i = 0; i < z->count; i++) {
+        if (zone_contains(&z->zones[i], position)) {
+            inside |= BIT(i);
+        }
+    }
+    return inside;
+}
+
+/**
+ * Queues an event, dropping the oldest if the reader fell behind
+ * Caller holds zone_lock
+ */
+static void zone_event_push(struct motorknob_file_zones *z, const struct motorknob_zone_event *event) {
+    if (z->head - z->tail == ZONE_EVENTS) {
+        z->tail++;
+        z->overrun = true;
+    }
+    z->events[z->head++ % ZONE_EVENTS] = *event;
+}
+
+/**
+ * Checks a new position against the zones of every file
+ * Files only get woken up for the transitions they asked for.
+ * seq is the history_head of the sample, publishers race here after the seqlock,
+ * a sample older than the one a file saw last is ignored.
+ */
+static void motorknob_zones_update(struct motorknob *mk, u16 position, u64 timestamp_ns, u64 seq) {
+    struct motorknob_file *mf;
+
+    if (list_empty_careful(&mk->zone_files)) {
+        return;
+    }
+
+    spin_lock(&mk->zone_lock);
+    list_for_each_entry(mf, &mk->zone_files, zone_node) {
+        struct motorknob_file_zones *z = mf->zones;
+        u32 inside = zones_inside(z, position);
+        unsigned long crossed = inside ^ z->inside;
+        struct motorknob_zone_event event = {
+            .timestamp_ns = timestamp_ns,
+            .position = position,
+            .inside = inside,
+        };
+        bool signal = false;
+        unsigned int i;
+
+        if (seq <= z->seq) {
+            continue;
+        }
+        z->seq = seq;
+        z->inside = inside;
+        for_each_set_bit(i, &crossed, MOTORKNOB_ZONES_MAX) {
+            event.zone = i;
+            event.flags = inside & BIT(i) ? MOTORKNOB_ZONE_ENTER : MOTORKNOB_ZONE_EXIT;
+            if (z->zones[i].flags & event.flags) {
+                zone_event_push(z, &event);
+                signal = true;
+            }
+        }
+
+        if (signal) {
+            wake_up_interruptible(&mf->zone_wait);
+            if (z->eventfd) {
+                motorknob_eventfd_signal(z->eventfd);
+            }
+        }
+    }
+    spin_unlock(&mk->zone_lock);
+}
+
+/**
+ * Makes a position the latest known one and appends it to the history
+ * A read that started before the latest known one is dropped,
+ * so the history stays ordered by time.
+ */
+static void motorknob_publish_sample(struct motorknob *mk, u16 position, ktime_t timestamp) {
+    u64 timestamp_ns = ktime_to_ns(timestamp);
+    u64 seq;
+
+    write_seqlock(&mk->sample_lock);
+    if (timestamp_ns < mk->sample.timestamp_ns) {
+        write_sequnlock(&mk->sample_lock);
+        return;
+    }
+
+    mk->sample.position = position;
+    mk->sample.timestamp_ns = timestamp_ns;
+    mk->sample.flags |= MOTORKNOB_SAMPLE_VALID;
+    if (mk->history_head > mk->history_mask) {
+        mk->history_dropped_ns = mk->history[mk->history_head & mk->history_mask].timestamp_ns;
+    }
+    mk->history[mk->history_head++ & mk->history_mask] = mk->sample;
+    seq = mk->history_head;
+    write_sequnlock(&mk->sample_lock);
+
+    wake_up_interruptible(&mk->history_wait);
+    motorknob_zones_update(mk, position, timestamp_ns, seq);
+}
+
+/**
+ * Copies the latest known position, head gets the number of samples published so far (may be NULL)
+ */
+static void motorknob_latest_sample_head(struct motorknob *mk, struct motorknob_sample *sample, u64 *head) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&mk->sample_lock);
+        *sample = mk->sample;
+        if (head) {
+            *head = mk->history_head;
+        }
+    } while (read_seqretry(&mk->sample_lock, seq));
+}
+
+/**
+ * Copies the latest known position
+ */
+static void motorknob_latest_sample(struct motorknob *mk, struct motorknob_sample *sample) {
+    motorknob_latest_sample_head(mk, sample, NULL);
+}
+
+/**
+ * Decides if this position read should be protected
+ */
+static bool motorknob_pec_position(struct motorknob *mk) {
+    switch (READ_ONCE(mk->pec.position_policy)) {
+    case PEC_ON:
+        return true;
+    case PEC_AUTO:
+        if (atomic_dec_if_positive(&mk->pec.auto_hold) >= 0) {
+            return true;
+        }
+        return (unsigned int) atomic_inc_return(&mk->pec.auto_count) % PEC_PROBE_INTERVAL == 0;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Does one SMBus word transfer, with or without PEC
+ * A failed checksum is counted and the transfer repeated once
+ */
+static s32 motorknob_xfer_word(struct motorknob *mk, char read_write, u8 reg, u16 word, bool use_pec) {
+    struct i2c_client *client = mk->client;
+    union i2c_smbus_data data;
+    unsigned short flags = client->flags & ~I2C_CLIENT_PEC;
+    int attempt;
+    s32 ret;
+
+    use_pec = use_pec && mk->pec.available;
+    if (use_pec) {
+        flags |= I2C_CLIENT_PEC;
+        atomic64_inc(&mk->pec.transactions);
+    }
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        data.word = word;
+        ret = i2c_smbus_xfer(client->adapter, client->addr, flags,
+                             read_write, reg, I2C_SMBUS_WORD_DATA, &data);
+        if (ret != -EBADMSG) {
+            break;
+        }
+
+        atomic64_inc(read_write == I2C_SMBUS_READ ? &mk->pec.read_errors : &mk->pec.write_errors);
+        atomic_set(&mk->pec.auto_hold, PEC_HOLD);
+    }
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    return read_write == I2C_SMBUS_READ ? data.word : 0;
+}
+
+/**
+ * Reads len bytes from consecutive registers in one i2c block transfer
+ * These carry no PEC, only for Knobs without it
+ */
+static s32 motorknob_read_block(struct motorknob *mk, u8 reg, u8 *buf, u8 len) {
+    struct i2c_client *client = mk->client;
+    union i2c_smbus_data data;
+    unsigned short flags = client->flags & ~I2C_CLIENT_PEC;
+    s32 ret;
+
+    if (len > I2C_SMBUS_BLOCK_MAX) {
+        return -EINVAL;
+    }
+
+    data.block[0] = len;
+    ret = i2c_smbus_xfer(client->adapter, client->addr, flags,
+                         I2C_SMBUS_READ, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(buf, &data.block[1], len);
+    return len;
+}
+
+/**
+ * Writes len bytes to consecutive registers in one i2c block transfer
+ * These carry no PEC, only for Knobs without it
+ */
+static s32 motorknob_write_block(struct motorknob *mk, u8 reg, const u8 *buf, u8 len) {
+    struct i2c_client *client = mk->client;
+    union i2c_smbus_data data;
+    unsigned short flags = client->flags & ~I2C_CLIENT_PEC;
+    s32 ret;
+
+    if (len > I2C_SMBUS_BLOCK_MAX) {
+        return -EINVAL;
+    }
+
+    data.block[0] = len;
+    memcpy(&data.block[1], buf, len);
+    ret = i2c_smbus_xfer(client->adapter, client->addr, flags,
+                         I2C_SMBUS_WRITE, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * Asks the firmware what it can do
+ * Old firmware without the register just has no capabilities
+ */
+static void motorknob_read_caps(struct motorknob *mk) {
+    struct i2c_client *client = mk->client;
+    s32 caps = i2c_smbus_read_word_data(client, DATA_CAPS);
+
+    // older firmware has no such register, a bus that reads 0xffff must not turn everything on
+    if (caps < 0 || (caps & ~CAP_KNOWN)) {
+        if (caps > 0) {
+            dev_warn(&client->dev, "Ignoring capabilities 0x%04x, reserved bits set\n", caps);
+        }
+        caps = 0;
+    }
+
+    mk->caps = caps;
+    mk->pec.available = (caps & CAP_PEC) && i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_PEC);
+
+    dev_info(&client->dev, "Capabilities 0x%04x, PEC %s\n", caps, mk->pec.available ? "on" : "off");
+}
+
+/**
+ * Transfers a run of adjacent registers, one block transfer if the firmware can
+ * Falls back to one word transfer per register, also when the block transfer failed.
+ * Reads fill words, results get 0 or -errno per register.
+ */
+static void motorknob_queue_transfer(struct motorknob *mk, bool write, u8 base, u16 *words, s32 *results, int count) {
+    struct motorknob_queue *q = &mk->queue;
+    u32 func = write ? I2C_FUNC_SMBUS_WRITE_I2C_BLOCK : I2C_FUNC_SMBUS_READ_I2C_BLOCK;
+    // i2c block transfers carry no PEC, with PEC every run has a register that needs it
+    bool block = count > 1 && (mk->caps & CAP_BLOCK) && !mk->pec.available &&
+                 i2c_check_functionality(mk->client->adapter, func);
+    bool profile = base < PROFILE_REGISTERS;
+    struct motorknob_profile *new = NULL;
+    u16 values[PROFILE_REGISTERS];
+    unsigned long touched = 0, changed = 0;
+    u64 transfers = 0;
+    u8 buf[QUEUE_RUN_MAX * 2];
+    ktime_t start;
+    s32 ret = -EIO;
+    int i;
+
+    // device and cache change together, the scrubber must not see them differ
+    // the copy is made up front, once the Knob has a value the cache has to take it
+    if (profile) {
+        new = kmalloc(sizeof(*new), GFP_KERNEL);
+        if (!new) {
+            for (i = 0; i < count; i++) {
+                results[i] = -ENOMEM;
+            }
+            return;
+        }
+        mutex_lock(&mk->profile_lock);
+    }
+
+    start = ktime_get();
+    if (block) {
+        if (write) {
+            for (i = 0; i < count; i++) {
+                buf[2 * i] = (u8) words[i];
+                buf[2 * i + 1] = (u8) (words[i] >> 8);
+            }
+            ret = motorknob_write_block(mk, WRITE_REQUEST | base, buf, count * 2);
+        } else {
+            ret = motorknob_read_block(mk, base, buf, count * 2);
+            for (i = 0; ret >= 0 && i < count; i++) {
+                words[i] = buf[2 * i] | (buf[2 * i + 1] << 8);
+            }
+        }
+        transfers++;
+
+        for (i = 0; i < count; i++) {
+            results[i] = ret < 0 ? ret : 0;
+        }
+    }
+
+    if (!block || ret < 0) {
+        for (i = 0; i < count; i++) {
+            u8 reg = base + i;
+            bool use_pec = write || reg != DATA_CURRENT_POS || motorknob_pec_position(mk);
+
+            ret = motorknob_xfer_word(mk, write ? I2C_SMBUS_WRITE : I2C_SMBUS_READ,
+                                      write ? WRITE_REQUEST | reg : reg, words[i], use_pec);
+            if (ret >= 0 && !write) {
+                words[i] = ret;
+            }
+            results[i] = ret < 0 ? ret : 0;
+            transfers++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        u8 reg = base + i;
+
+        if (results[i] < 0) {
+            continue;
+        }
+        if (reg < PROFILE_REGISTERS) {
+            values[reg] = words[i];
+            touched |= BIT(reg);
+        } else if (!write && reg == DATA_CURRENT_POS) {
+            // positions read this way are published like sampled ones
+            motorknob_publish_sample(mk, words[i], start);
+        }
+    }
+
+    if (profile) {
+        changed = motorknob_profile_publish(mk, new, values, touched, !write);
+        mutex_unlock(&mk->profile_lock);
+        if (!write) {
+            changed = 0;
+        }
+    }
+
+    motorknob_profile_changed(mk, changed);
+
+    spin_lock(&q->lock);
+    q->transfers += transfers;
+    if (block) {
+        q->block_transfers++;
+        q->block_fallbacks += transfers > 1;
+    }
+    spin_unlock(&q->lock);
+}
+
+// writes first, then by register, list_sort keeps writes to one register in order
+static int motorknob_request_cmp(void *priv, const struct list_head *a, const struct list_head *b) {
+    const struct motorknob_request *ra = list_entry(a, struct motorknob_request, node);
+    const struct motorknob_request *rb = list_entry(b, struct motorknob_request, node);
+
+    if (ra->write != rb->write) {
+        return ra->write ? -1 : 1;
+    }
+    return ra->reg - rb->reg;
+}
+
+/**
+ * Transfers a batch of requests and completes them
+ * Every run of requests for adjacent registers in the same direction is one
+ * transfer, the last write to a register wins.
+ */
+static void motorknob_queue_dispatch(struct motorknob *mk, struct list_head *batch) {
+    struct motorknob_request *first, *req, *next;
+    u16 words[QUEUE_RUN_MAX];
+    s32 results[QUEUE_RUN_MAX];
+
+    list_sort(NULL, batch, motorknob_request_cmp);
+
+    first = list_first_entry(batch, struct motorknob_request, node);
+    while (&first->node != batch) {
+        u8 base = first->reg;
+        int count = 0;
+
+        req = first;
+        list_for_each_entry_from(req, batch, node) {
+            int offset = req->reg - base;
+
+            if (req->write != first->write || offset > count || offset >= QUEUE_RUN_MAX) {
+                break;
+            }
+            words[offset] = req->write ? req->word : 0;
+            count = offset + 1;
+        }
+
+        motorknob_queue_transfer(mk, first->write, base, words, results, count);
+
+        for (; first != req; first = list_next_entry(first, node)) {
+            first->result = results[first->reg - base];
+            if (!first->write) {
+                first->word = words[first->reg - base];
+            }
+        }
+    }
+
+    // the caller may return once its last request is done, do not touch it afterwards
+    list_for_each_entry_safe(req, next, batch, node) {
+        list_del(&req->node);
+        atomic_dec_return_release(req->pending);
+    }
+}
+
+/**
+ * Queues requests and returns once all of them are done
+ * Requests queued together always end up in the same batch. Without window a
+ * leader dispatches right away, for callers that are on a schedule.
+ */
+static void motorknob_submit_window(struct motorknob *mk, struct motorknob_request *reqs, int count, bool window) {
+    struct motorknob_queue *q = &mk->queue;
+    atomic_t pending = ATOMIC_INIT(count);
+    LIST_HEAD(batch);
+    unsigned int window_us;
+    u64 size;
+    bool leader;
+    int i;
+
+    spin_lock(&q->lock);
+    for (i = 0; i < count; i++) {
+        reqs[i].pending = &pending;
+        list_add_tail(&reqs[i].node, &q->pending);
+    }
+    q->requests += count;
+    leader = !q->busy;
+    q->busy = true;
+    spin_unlock(&q->lock);
+
+    if (!leader) {
+        // the batch is dispatched sorted, any of them may be done last
+        wait_event(q->wait, !atomic_read_acquire(&pending));
+        return;
+    }
+
+    window_us = window ? READ_ONCE(q->window_us) : 0;
+    if (window_us) {
+        usleep_range(window_us, window_us + window_us / 4);
+    }
+
+    // also takes whatever queued up while the bus was busy
+    spin_lock(&q->lock);
+    while (!list_empty(&q->pending)) {
+        list_splice_init(&q->pending, &batch);
+        spin_unlock(&q->lock);
+
+        size = list_count_nodes(&batch);
+        motorknob_queue_dispatch(mk, &batch);
+        wake_up_all(&q->wait);
+
+        spin_lock(&q->lock);
+        q->batches++;
+        q->max_batch = max(q->max_batch, size);
+    }
+    q->busy = false;
+    spin_unlock(&q->lock);
+}
+
+static void motorknob_submit(struct motorknob *mk, struct motorknob_request *reqs, int count) {
+    motorknob_submit_window(mk, reqs, count, true);
+}
+
+/**
+ * Writes a word (16bit) to a register of the MotorKnob
+ */
+static s32 motorknob_write_word(struct motorknob *mk, u8 reg, u16 word) {
+    struct motorknob_request req = {
+        .reg = reg & ~WRITE_REQUEST,
+        .write = true,
+        .word = word,
+    };
+
+    motorknob_submit(mk, &req, 1);
+    if (req.result < 0) {
+        pr_err("Failed to send data: %d\n", req.result);
+        return req.result;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a word (16bit) from a register of the MotorKnob
+ * Positions read this way are published like sampled ones
+ */
+static s32 motorknob_read_word(struct motorknob *mk, u8 reg) {
+    struct motorknob_request req = {
+        .reg = reg,
+    };
+
+    motorknob_submit(mk, &req, 1);
+    if (req.result < 0) {
+	    pr_err("Failed to read byte");
+    	return req.result;
+    }
+
+    return req.word;
+}
+
+/**
+ * Writes all profile registers as one batch, one block transfer if the Knob can
+ */
+static int motorknob_write_profile(struct motorknob *mk, const u16 *values) {
+    struct motorknob_request reqs[PROFILE_REGISTERS];
+    int i;
+
+    for (i = 0; i < PROFILE_REGISTERS; i++) {
+        reqs[i] = (struct motorknob_request) {
+            .reg = i,
+            .write = true,
+            .word = values[i],
+        };
+    }
+
+    motorknob_submit(mk, reqs, ARRAY_SIZE(reqs));
+
+    for (i = 0; i < PROFILE_REGISTERS; i++) {
+        if (reqs[i].result < 0) {
+            return reqs[i].result;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Latest position, read from the Knob only if the known one is older than max_age_ns
+ * Single flight: callers waiting for someone else's read take whatever got published
+ * after they arrived, be it that read or a sample, so concurrent callers cost one read.
+ */
+static int motorknob_position(struct motorknob *mk, u64 max_age_ns, struct motorknob_sample *sample) {
+    struct motorknob_queue *q = &mk->queue;
+    u64 *counter = &q->position_cached;
+    u64 head, now_head;
+    s32 ret = 0;
+
+    motorknob_latest_sample_head(mk, sample, &head);
+    if ((sample->flags & MOTORKNOB_SAMPLE_VALID) && ktime_get_ns() - sample->timestamp_ns <= max_age_ns) {
+        goto out;
+    }
+
+    mutex_lock(&mk->position_lock);
+    motorknob_latest_sample_head(mk, sample, &now_head);
+    if (now_head != head) {
+        counter = &q->position_shared;
+    } else {
+        counter = &q->position_reads;
+        ret = motorknob_read_word(mk, DATA_CURRENT_POS);
+        motorknob_latest_sample(mk, sample);
+    }
+    mutex_unlock(&mk->position_lock);
+
+out:
+    spin_lock(&q->lock);
+    (*counter)++;
+    spin_unlock(&q->lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+static void setup_queue(struct motorknob *mk) {
+    struct motorknob_queue *q = &mk->queue;
+
+    spin_lock_init(&q->lock);
+    INIT_LIST_HEAD(&q->pending);
+    init_waitqueue_head(&q->wait);
+    q->window_us = QUEUE_WINDOW_DEFAULT;
+}
+
+/**
+ * Queue counters, merged is how many requests did not need a transfer of their own
+ */
+static int motorknob_queue_show(struct seq_file *s, void *unused) {
+    struct motorknob *mk = s->private;
+    struct motorknob_queue *q = &mk->queue;
+    u64 requests, transfers, block_transfers, block_fallbacks, batches, max_batch;
+    u64 position_cached, position_shared, position_reads;
+
+    spin_lock(&q->lock);
+    requests = q->requests;
+    transfers = q->transfers;
+    block_transfers = q->block_transfers;
+    block_fallbacks = q->block_fallbacks;
+    batches = q->batches;
+    max_batch = q->max_batch;
+    position_cached = q->position_cached;
+    position_shared = q->position_shared;
+    position_reads = q->position_reads;
+    spin_unlock(&q->lock);
+
+    seq_printf(s, "requests        %llu\n", requests);
+    seq_printf(s, "transfers       %llu\n", transfers);
+    seq_printf(s, "merged          %llu\n", requests > transfers ? requests - transfers : 0);
+    seq_printf(s, "block_transfers %llu\n", block_transfers);
+    seq_printf(s, "block_fallbacks %llu\n", block_fallbacks);
+    seq_printf(s, "batches         %llu\n", batches);
+    seq_printf(s, "max_batch       %llu\n", max_batch);
+    seq_printf(s, "position_cached %llu\n", position_cached);
+    seq_printf(s, "position_shared %llu\n", position_shared);
+    seq_printf(s, "position_reads  %llu\n", position_reads);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(motorknob_queue);
+
+static void setup_debugfs(struct motorknob *mk) {
+    mk->debugfs = debugfs_create_dir(kobject_name(&mk->kobj), motorknob_debugfs);
+    debugfs_create_file("queue", 0444, mk->debugfs, mk, &motorknob_queue_fops);
+    debugfs_create_u64("context_switches", 0444, mk->debugfs, &mk->context_switches);
+    debugfs_create_u64("context_skipped", 0444, mk->debugfs, &mk->context_skipped);
+}
+
+static void destroy_debugfs(struct motorknob *mk) {
+    debugfs_remove_recursive(mk->debugfs);
+}
+
+/**
+ * Writes a word (16bit) to MotorKnob
+ * Uses first and second element in buffer
+ */
+static ssize_t motorknob_write(struct motorknob *mk, u8 reg, const char *user_buffer, size_t count) {
+    // Check for valid data length
+    if (count < 2) {
+        return -EINVAL; // Invalid argument (too few bytes)
+    }
+
+    // build word
+    uint16_t word = ((uint16_t) user_buffer[0]) << 8;
+    word ^= user_buffer[1];
+
+    s32 ret = motorknob_write_word(mk, reg, word);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return count; // Indicate successful write of all bytes
+}
+
+/**
+ * Reads a word (16bit) from MotorKnob
+ * buffer needs to be atleast two bytes big
+ */
+static ssize_t motorknob_read(struct motorknob *mk, u8 reg, char *user_buffer) {
+    s32 result = motorknob_read_word(mk, reg);
+
+    if (result < 0) {
+    	return result;
+    }
+
+    user_buffer[0] = (u8) result;
+    user_buffer[1] = (u8) (result >> 8);
+
+    return 2;
+}
+
+static void motorknob_hid_report(struct motorknob *mk, u16 position, ktime_t timestamp);
+
+/**
+ * Computes the torque for one control step
+ * Walls come from the cached start and end position
+ */
+static s16 motorknob_control_torque(struct motorknob *mk, u16 position, s32 velocity) {
+    struct motorknob_control *control = &mk->control;
+    const struct motorknob_profile *profile;
+    u16 start, end;
+    u8 valid;
+    s64 torque = 0;
+    int pos = position;
+
+    // start and end always from the same profile, never half of an update
+    rcu_read_lock();
+    profile = rcu_dereference(mk->profile);
+    start = profile->values[DATA_START_POS];
+    end = profile->values[DATA_END_POS];
+    valid = profile->valid;
+    rcu_read_unlock();
+
+    if ((valid & BIT(DATA_START_POS)) && pos < start) {
+        torque += (s64) READ_ONCE(control->wall_stiffness) * (start - pos);
+    }
+
+    if ((valid & BIT(DATA_END_POS)) && pos > end) {
+        torque -= (s64) READ_ONCE(control->wall_stiffness) * (pos - end);
+    }
+
+    torque -= (s64) READ_ONCE(control->spring_stiffness) * (pos - READ_ONCE(control->spring_center));
+
+    if (velocity > 0) {
+        torque -= (s64) READ_ONCE(control->friction) << 8;
+    } else if (velocity < 0) {
+        torque += (s64) READ_ONCE(control->friction) << 8;
+    }
+
+    torque >>= 8;
+
+    return clamp_t(s64, torque, -READ_ONCE(control->torque_limit), READ_ONCE(control->torque_limit));
+}
+
+/**
+ * Tracks how far the actual loop period is off the requested one
+ */
+static void motorknob_sampler_account(struct motorknob_sampler *sampler, ktime_t start) {
+    s64 jitter;
+
+    if (sampler->last_start == 0) {
+        sampler->last_start = start;
+        return;
+    }
+
+    jitter = ktime_to_ns(ktime_sub(ktime_sub(start, sampler->last_start), sampler->period));
+    sampler->last_start = start;
+
+    spin_lock(&sampler->stats_lock);
+    if (sampler->loops == 0 || jitter < sampler->jitter_min) {
+        sampler->jitter_min = jitter;
+    }
+    if (sampler->loops == 0 || jitter > sampler->jitter_max) {
+        sampler->jitter_max = jitter;
+    }
+    sampler->jitter_abs_sum += abs(jitter);
+    sampler->loops++;
+    spin_unlock(&sampler->stats_lock);
+}
+
+/**
+ * Queues a Knob on its bus, due_time is when it should have been sampled
+ * Returns false if it still was from before, a tick taking over a trigger is not
+ */
+static bool motorknob_sampler_queue(struct motorknob_sampler *sampler, ktime_t due_time, bool periodic) {
+    struct motorknob_bus *bus = sampler->bus;
+    unsigned long flags;
+    bool queued = false;
+
+    spin_lock_irqsave(&bus->lock, flags);
+    if (!sampler->due) {
+        sampler->due = true;
+        sampler->due_periodic = periodic;
+        sampler->due_time = due_time;
+        list_add_tail(&sampler->due_node, &bus->due);
+        queued = true;
+    } else if (periodic && !sampler->due_periodic) {
+        // the pending read serves the tick
+        sampler->due_periodic = true;
+        sampler->due_time = due_time;
+        queued = true;
+    }
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    wake_up_process(bus->thread);
+    return queued;
+}
+
+/**
+ * Queues a Knob on its bus right away instead of on its next tick
+ */
+static void motorknob_sampler_kick(struct motorknob *mk) {
+    motorknob_sampler_queue(&mk->sampler, ktime_get(), false);
+}
+
+/**
+ * Hands a new position on to the linked Knob as its spring center
+ */
+static void motorknob_link_drive(struct motorknob *mk, u16 position, ktime_t timestamp) {
+    struct motorknob *target;
+    s64 setpoint;
+
+    rcu_read_lock();
+    target = rcu_dereference(mk->link.target);
+    if (target && READ_ONCE(target->control.enabled)) {
+        setpoint = (((s64) position * READ_ONCE(mk->link.ratio)) >> 8) + READ_ONCE(mk->link.offset);
+        WRITE_ONCE(target->control.spring_center, clamp_t(s64, setpoint, 0, U16_MAX));
+        atomic64_set(&target->link.pending_ns, ktime_to_ns(timestamp));
+        motorknob_sampler_kick(target);
+    }
+    rcu_read_unlock();
+}
+
+/**
+ * Accounts the latency of a setpoint once a torque for it is written
+ */
+static void motorknob_link_account(struct motorknob *mk) {
+    struct motorknob_link *link = &mk->link;
+    s64 pending_ns = atomic64_xchg(&link->pending_ns, 0);
+    u64 latency;
+
+    if (!pending_ns) {
+        return;
+    }
+
+    latency = ktime_get_ns() - pending_ns;
+    spin_lock(&link->stats_lock);
+    link->latency_count++;
+    link->latency_max = max(link->latency_max, latency);
+    link->latency_sum += latency;
+    spin_unlock(&link->stats_lock);
+}
+
+/**
+ * Gives the sampler a fresh base position, returns it or -errno
+ * For relative reads the delta register is cleared right after the base is read.
+ * Motion in between would be counted twice, so that is repeated until the delta stays 0.
+ * Caller holds sample_mutex
+ */
+static s32 motorknob_sampler_rebase(struct motorknob *mk, bool relative) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+    s32 position = -EIO, delta = 0;
+    int tries;
+
+    if (relative) {
+        delta = motorknob_xfer_word(mk, I2C_SMBUS_READ, DATA_DELTA, 0, true);
+        if (delta < 0) {
+            return delta;
+        }
+    }
+
+    for (tries = 0; tries < REBASE_TRIES; tries++) {
+        position = motorknob_xfer_word(mk, I2C_SMBUS_READ, DATA_CURRENT_POS, 0, true);
+        if (position < 0 || !relative) {
+            break;
+        }
+        // also clears it for the next try
+        delta = motorknob_xfer_word(mk, I2C_SMBUS_READ, DATA_DELTA, 0, true);
+        if (delta <= 0) {
+            break;
+        }
+    }
+
+    if (position < 0) {
+        return position;
+    }
+    if (delta) {
+        return delta < 0 ? delta : -EBUSY;
+    }
+
+    sampler->base = position;
+    sampler->base_valid = true;
+    WRITE_ONCE(mk->relative, relative);
+    return position;
+}
+
+/**
+ * Takes one sample and runs everything depending on it
+ * timestamp is when the position was current, the interrupt time if it came from one.
+ * Caller holds sample_mutex.
+ */
+static void motorknob_sample(struct motorknob *mk, ktime_t timestamp) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+    struct motorknob_sample last;
+    bool valid, changed, relative;
+    ktime_t xfer_start;
+    u16 position;
+    s16 delta;
+    s32 result;
+    u64 xfer_ns;
+
+    motorknob_latest_sample(mk, &last);
+    valid = last.flags & MOTORKNOB_SAMPLE_VALID;
+
+    // read after the latest known position, whatever the interrupt says
+    // strictly after, history readers continue from the last timestamp they saw
+    if (valid && ktime_to_ns(timestamp) <= last.timestamp_ns) {
+        timestamp = ns_to_ktime(last.timestamp_ns + 1);
+    }
+
+    // relative is only set together with a base
+    relative = READ_ONCE(mk->relative);
+    xfer_start = ktime_get();
+
+    if (relative) {
+        // read and clear, a lost delta is lost motion so always checked
+        result = motorknob_xfer_word(mk, I2C_SMBUS_READ, DATA_DELTA, 0, true);
+    } else {
+        result = motorknob_xfer_word(mk, I2C_SMBUS_READ, DATA_CURRENT_POS, 0, motorknob_pec_position(mk));
+    }
+    xfer_ns = ktime_to_ns(ktime_sub(ktime_get(), xfer_start));
+
+    if (result < 0) {
+        pr_err_ratelimited("motorknob-sampler - Failed to read %s: %d\n", relative ? "delta" : "position", result);
+        trace_motorknob_sample_end(mk->index, result, xfer_ns, 0, ktime_get_ns());
+        return;
+    }
+
+    if (relative) {
+        delta = result;
+        position = sampler->base + delta;
+    } else {
+        position = result;
+        delta = sampler->base_valid ? (s16) (position - sampler->base) : 0;
+    }
+    sampler->base = position;
+    sampler->base_valid = true;
+
+    changed = !valid || last.position != position;
+
+    sampler->velocity = delta;
+    WRITE_ONCE(mk->accumulated, mk->accumulated + delta);
+    motorknob_publish_sample(mk, position, timestamp);
+
+    if (changed) {
+        motorknob_hid_report(mk, position, timestamp);
+        motorknob_link_drive(mk, position, timestamp);
+    }
+    trace_motorknob_sample_end(mk->index, 0, xfer_ns, ktime_to_ns(timestamp), ktime_get_ns());
+
+    if (READ_ONCE(mk->control.enabled)) {
+        s16 torque = motorknob_control_torque(mk, position, sampler->velocity);
+
+        result = motorknob_xfer_word(mk, I2C_SMBUS_WRITE, WRITE_TORQUE, (u16) torque, true);
+        if (result < 0) {
+            pr_err_ratelimited("motorknob-control - Failed to write torque: %d\n", result);
+        } else {
+            motorknob_link_account(mk);
+        }
+    }
+}
+
+static enum hrtimer_restart motorknob_sampler_tick(struct hrtimer *timer) {
+    struct motorknob_sampler *sampler = container_of(timer, struct motorknob_sampler, timer);
+
+    if (!motorknob_sampler_queue(sampler, hrtimer_get_expires(timer), true)) {
+        // bus did not keep up
+        sampler->overruns++;
+    }
+
+    hrtimer_forward_now(timer, READ_ONCE(sampler->period));
+    return HRTIMER_RESTART;
+}
+
+static enum hrtimer_restart motorknob_sampler_trigger(struct hrtimer *timer) {
+    struct motorknob_sampler *sampler = container_of(timer, struct motorknob_sampler, trigger);
+
+    motorknob_sampler_queue(sampler, hrtimer_get_expires(timer), false);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * Arms a fresh read for at_ns minus the trigger offset, 0 is now
+ */
+static void motorknob_sampler_arm(struct motorknob *mk, u64 at_ns) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+    ktime_t at = at_ns ? ns_to_ktime(at_ns - (u64) READ_ONCE(sampler->trigger_offset_us) * NSEC_PER_USEC)
+                       : ktime_get();
+
+    mutex_lock(&sampler->lock);
+    if (!sampler->stopped) {
+        hrtimer_start(&sampler->trigger, at, HRTIMER_MODE_ABS);
+    }
+    mutex_unlock(&sampler->lock);
+}
+
+/**
+ * Picks the next due Knob, one on the current channel if there is any and it had no long streak
+ * Caller holds bus->lock
+ */
+static struct motorknob_sampler *motorknob_bus_next(struct motorknob_bus *bus) {
+    struct motorknob_sampler *sampler;
+
+    if (bus->channel_streak >= CHANNEL_STREAK_MAX) {
+        return list_first_entry_or_null(&bus->due, struct motorknob_sampler, due_node);
+    }
+    list_for_each_entry(sampler, &bus->due, due_node) {
+        if (container_of(sampler, struct motorknob, sampler)->client->adapter == bus->channel) {
+            return sampler;
+        }
+    }
+
+    return list_first_entry_or_null(&bus->due, struct motorknob_sampler, due_node);
+}
+
+/**
+ * Samples one Knob and accounts the channel switch and latency
+ * Only ticks count towards jitter and latency, triggered reads have their own
+ */
+static void motorknob_bus_sample(struct motorknob_bus *bus, struct motorknob *mk, ktime_t due_time, bool periodic) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+    struct i2c_adapter *adapter = mk->client->adapter;
+    ktime_t start;
+    u64 latency;
+
+    // going back to the root adapter selects nothing
+    if (adapter != bus->channel) {
+        if (adapter != bus->root) {
+            WRITE_ONCE(bus->channel_switches, bus->channel_switches + 1);
+        }
+        bus->channel = adapter;
+        bus->channel_streak = 0;
+    }
+    bus->channel_streak++;
+
+    mutex_lock(&mk->sample_mutex);
+    start = ktime_get();
+    trace_motorknob_sample_begin(mk->index, false, ktime_to_ns(due_time), ktime_to_ns(start));
+    if (periodic) {
+        motorknob_sampler_account(sampler, start);
+    }
+    motorknob_sample(mk, start);
+    mutex_unlock(&mk->sample_mutex);
+    WRITE_ONCE(bus->samples, bus->samples + 1);
+
+    latency = ktime_to_ns(ktime_sub(ktime_get(), due_time));
+    spin_lock(&sampler->stats_lock);
+    if (periodic) {
+        sampler->latency_count++;
+        sampler->latency_max = max(sampler->latency_max, latency);
+        sampler->latency_sum += latency;
+    } else {
+        sampler->triggered_count++;
+        sampler->triggered_max = max(sampler->triggered_max, latency);
+        sampler->triggered_sum += latency;
+    }
+    spin_unlock(&sampler->stats_lock);
+}
+
+static int motorknob_bus_thread(void *data) {
+    struct motorknob_bus *bus = data;
+    struct motorknob_sampler *sampler;
+    ktime_t due_time;
+    bool periodic;
+
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        spin_lock_irq(&bus->lock);
+        sampler = motorknob_bus_next(bus);
+        if (!sampler) {
+            spin_unlock_irq(&bus->lock);
+            schedule();
+            continue;
+        }
+        __set_current_state(TASK_RUNNING);
+
+        list_del_init(&sampler->due_node);
+        sampler->due = false;
+        due_time = sampler->due_time;
+        periodic = sampler->due_periodic;
+        bus->active = sampler;
+        spin_unlock_irq(&bus->lock);
+
+        motorknob_bus_sample(bus, container_of(sampler, struct motorknob, sampler), due_time, periodic);
+
+        spin_lock_irq(&bus->lock);
+        bus->active = NULL;
+        spin_unlock_irq(&bus->lock);
+        wake_up_all(&bus->idle);
+    }
+
+    return 0;
+}
+
+/**
+ * Finds or starts the sampler thread of the root adapter a Knob is behind
+ */
+static struct motorknob_bus *motorknob_bus_get(struct i2c_adapter *adapter) {
+    struct i2c_adapter *root = i2c_root_adapter(&adapter->dev);
+    struct motorknob_bus *bus;
+    int ret;
+
+    mutex_lock(&motorknob_buses_lock);
+    list_for_each_entry(bus, &motorknob_buses, node) {
+        if (bus->root == root) {
+            bus->knobs++;
+            goto out;
+        }
+    }
+
+    bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+    if (!bus) {
+        bus = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+
+    bus->root = root;
+    bus->knobs = 1;
+    spin_lock_init(&bus->lock);
+    INIT_LIST_HEAD(&bus->due);
+    init_waitqueue_head(&bus->idle);
+
+    bus->thread = kthread_run(motorknob_bus_thread, bus, "motorknob/i2c-%d", root->nr);
+    if (IS_ERR(bus->thread)) {
+        ret = PTR_ERR(bus->thread);
+        kfree(bus);
+        bus = ERR_PTR(ret);
+        goto out;
+    }
+
+    // a late sample is a soft wall
+    sched_set_fifo(bus->thread);
+    list_add_tail(&bus->node, &motorknob_buses);
+
+out:
+    mutex_unlock(&motorknob_buses_lock);
+    return bus;
+}
+
+static void motorknob_bus_put(struct motorknob_bus *bus) {
+    mutex_lock(&motorknob_buses_lock);
+    if (--bus->knobs == 0) {
+        list_del(&bus->node);
+        kthread_stop(bus->thread);
+        kfree(bus);
+    }
+    mutex_unlock(&motorknob_buses_lock);
+}
+
+/**
+ * Next multiple of the period, Knobs with the same rate tick together
+ */
+static ktime_t motorknob_sampler_aligned(ktime_t period) {
+    u64 period_ns = ktime_to_ns(period);
+
+    return ns_to_ktime(DIV64_U64_ROUND_UP(ktime_get_ns() + 1, period_ns) * period_ns);
+}
+
+/**
+ * Starts sampling for one more user
+ */
+static void motorknob_sampler_get(struct motorknob *mk) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+
+    mutex_lock(&sampler->lock);
+    if (sampler->users++ == 0) {
+        sampler->last_start = 0;
+        hrtimer_start(&sampler->timer, motorknob_sampler_aligned(sampler->period), HRTIMER_MODE_ABS);
+    }
+    mutex_unlock(&sampler->lock);
+}
+
+/**
+ * Takes a Knob off its bus, waits if it is being sampled right now
+ * The timer has to be stopped already.
+ */
+static void motorknob_sampler_dequeue(struct motorknob *mk) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+    struct motorknob_bus *bus = sampler->bus;
+
+    spin_lock_irq(&bus->lock);
+    list_del_init(&sampler->due_node);
+    sampler->due = false;
+    spin_unlock_irq(&bus->lock);
+
+    wait_event(bus->idle, READ_ONCE(bus->active) != sampler);
+}
+
+/**
+ * Stops sampling once the last user is gone
+ */
+static void motorknob_sampler_put(struct motorknob *mk) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+
+    mutex_lock(&sampler->lock);
+    if (--sampler->users == 0) {
+        hrtimer_cancel(&sampler->timer);
+        motorknob_sampler_dequeue(mk);
+    }
+    mutex_unlock(&sampler->lock);
+}
+
+/**
+ * Attaches the (idle) sampler to the thread of its bus
+ */
+static int setup_sampler(struct motorknob *mk) {
+    struct motorknob_sampler *sampler = &mk->sampler;
+
+    mutex_init(&sampler->lock);
+    spin_lock_init(&sampler->stats_lock);
+    INIT_LIST_HEAD(&sampler->due_node);
+    sampler->period = ns_to_ktime(NSEC_PER_SEC / SAMPLE_RATE_DEFAULT);
+
+    motorknob_hrtimer_setup(&sampler->timer, motorknob_sampler_tick, HRTIMER_MODE_ABS);
+    motorknob_hrtimer_setup(&sampler->trigger, motorknob_sampler_trigger, HRTIMER_MODE_ABS);
+
+    sampler->bus = motorknob_bus_get(mk->client->adapter);
+    if (IS_ERR(sampler->bus)) {
+        return PTR_ERR(sampler->bus);
+    }
+
+    return 0;
+}
+
+static void destroy_sampler(struct motorknob *mk) {
+    mutex_lock(&mk->sampler.lock);
+    mk->sampler.stopped = true;
+    mutex_unlock(&mk->sampler.lock);
+
+    hrtimer_cancel(&mk->sampler.trigger);
+    hrtimer_cancel(&mk->sampler.timer);
+    motorknob_sampler_dequeue(mk);
+    motorknob_bus_put(mk->sampler.bus);
+}
+
+/*
+ * Interrupt
+ * Knobs wired to an interrupt pull it when the position changes. The hard
+ * handler only takes the time, the position read in the thread gets that
+ * timestamp everywhere: history, snapshots, HID/evdev and age_ns.
+ */
+static irqreturn_t motorknob_irq(int irq, void *data) {
+    struct motorknob *mk = data;
+
+    mk->irq_time = ktime_get();
+    return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t motorknob_irq_thread(int irq, void *data) {
+    struct motorknob *mk = data;
+
+    mutex_lock(&mk->sample_mutex);
+    trace_motorknob_sample_begin(mk->index, true, ktime_to_ns(mk->irq_time), ktime_get_ns());
+    motorknob_sample(mk, mk->irq_time);
+    mutex_unlock(&mk->sample_mutex);
+
+    return IRQ_HANDLED;
+}
+
+/**
+ * Requests the interrupt if the Knob has one, polling still works without
+ */
+static void setup_irq(struct motorknob *mk) {
+    struct i2c_client *client = mk->client;
+    int ret;
+
+    if (client->irq <= 0) {
+        return;
+    }
+
+    // oneshot keeps a level interrupt masked until the thread read the Knob
+    ret = request_threaded_irq(client->irq, motorknob_irq, motorknob_irq_thread, IRQF_ONESHOT,
+                               dev_name(&client->dev), mk);
+    if (ret < 0) {
+        dev_warn(&client->dev, "Failed to request interrupt %d: %d\n", client->irq, ret);
+        return;
+    }
+
+    mk->irq = client->irq;
+}
+
+static void destroy_irq(struct motorknob *mk) {
+    if (mk->irq) {
+        free_irq(mk->irq, mk);
+    }
+}
+
+/**
+ * Reads back all profile registers, one block transfer if the firmware can and PEC is off
+ */
+static int motorknob_scrub_read(struct motorknob *mk, u16 *values) {
+    u8 buf[PROFILE_REGISTERS * 2];
+    int i;
+
+    if ((mk->caps & CAP_BLOCK) && !mk->pec.available) {
+        s32 ret = motorknob_read_block(mk, DATA_START_POS, buf, sizeof(buf));
+        if (ret < 0) {
+            return ret;
+        }
+        for (i = 0; i < PROFILE_REGISTERS; i++) {
+            values[i] = buf[2 * i] | (buf[2 * i + 1] << 8);
+        }
+        return 0;
+    }
+
+    for (i = 0; i < PROFILE_REGISTERS; i++) {
+        s32 ret = motorknob_xfer_word(mk, I2C_SMBUS_READ, i, 0, true);
+        if (ret < 0) {
+            return ret;
+        }
+        values[i] = ret;
+    }
+
+    return 0;
+}
+
+static void motorknob_scrub_work(struct work_struct *work) {
+    struct motorknob_scrub *scrub = container_of(to_delayed_work(work), struct motorknob_scrub, work);
+    struct motorknob *mk = container_of(scrub, struct motorknob, scrub);
+    const struct motorknob_profile *profile;
+    u16 values[PROFILE_REGISTERS];
+    unsigned int interval_ms, budget_us;
+    u64 delay_ms;
+    ktime_t start;
+    int ret;
+    u8 reg;
+
+    mutex_lock(&mk->profile_lock);
+    profile = rcu_dereference_protected(mk->profile, lockdep_is_held(&mk->profile_lock));
+    start = ktime_get();
+
+    ret = motorknob_scrub_read(mk, values);
+    if (ret < 0) {
+        scrub->errors++;
+    }
+
+    for (reg = 0; ret == 0 && reg < PROFILE_REGISTERS; reg++) {
+        if (!(profile->valid & BIT(reg)) || values[reg] == profile->values[reg]) {
+            continue;
+        }
+
+        scrub->mismatches++;
+        dev_warn_ratelimited(&mk->client->dev, "Register 0x%02x is 0x%04x instead of 0x%04x, repairing\n",
+                             reg, values[reg], profile->values[reg]);
+
+        if (motorknob_xfer_word(mk, I2C_SMBUS_WRITE, WRITE_REQUEST | reg, profile->values[reg], true) < 0) {
+            scrub->errors++;
+        } else {
+            scrub->repairs++;
+        }
+    }
+
+    scrub->last_bus_us = ktime_us_delta(ktime_get(), start);
+    scrub->runs++;
+    mutex_unlock(&mk->profile_lock);
+
+    interval_ms = READ_ONCE(scrub->interval_ms);
+    budget_us = READ_ONCE(scrub->budget_us);
+    if (!interval_ms) {
+        return;
+    }
+
+    // bus time / budget per second is the earliest we may run again
+    delay_ms = interval_ms;
+    if (budget_us) {
+        delay_ms = max_t(u64, delay_ms, div_u64(scrub->last_bus_us * MSEC_PER_SEC, budget_us));
+    }
+
+    queue_delayed_work(system_unbound_wq, &scrub->work, msecs_to_jiffies(min_t(u64, delay_ms, UINT_MAX)));
+}
+
+static void setup_scrub(struct motorknob *mk) {
+    INIT_DELAYED_WORK(&mk->scrub.work, motorknob_scrub_work);
+    mk->scrub.interval_ms = SCRUB_INTERVAL_DEFAULT;
+    mk->scrub.budget_us = SCRUB_BUDGET_DEFAULT;
+
+    queue_delayed_work(system_unbound_wq, &mk->scrub.work, msecs_to_jiffies(mk->scrub.interval_ms));
+}
+
+static void destroy_scrub(struct motorknob *mk) {
+    WRITE_ONCE(mk->scrub.interval_ms, 0);
+    cancel_delayed_work_sync(&mk->scrub.work);
+}
+
+/*
+ * HID
+ * The Knob also shows up as a virtual HID device: a dial fed by the sampler
+ * plus a feature report mirroring the profile registers.
+ * That way hidraw and HID-BPF work without any extra daemon.
+ */
+#define HID_REPORT_POSITION 1
+#define HID_REPORT_PROFILE  2
+
+#define HID_POSITION_SIZE 11 // id + position + timestamp_ns
+#define HID_PROFILE_SIZE  7 // id + start + end + detents
+
+static const u8 motorknob_hid_report_desc[] = {
+    0x05, 0x01,                   // Usage Page (Generic Desktop)
+    0x09, 0x08,                   // Usage (Multi-axis Controller)
+    0xa1, 0x01,                   // Collection (Application)
+    0x85, HID_REPORT_POSITION,    //   Report ID
+    0x09, 0x37,                   //   Usage (Dial)
+    0x15, 0x00,                   //   Logical Minimum (0)
+    0x27, 0xff, 0xff, 0x00, 0x00, //   Logical Maximum (65535)
+    0x75, 0x10,                   //   Report Size (16)
+    0x95, 0x01,                   //   Report Count (1)
+    0x81, 0x02,                   //   Input (Data, Variable, Absolute)
+    0x06, 0x00, 0xff,             //   Usage Page (Vendor Defined)
+    0x09, 0x04,                   //   Usage (Timestamp low)
+    0x09, 0x05,                   //   Usage (Timestamp high)
+    0x27, 0xff, 0xff, 0xff, 0xff, //   Logical Maximum (2^32 - 1)
+    0x75, 0x20,                   //   Report Size (32)
+    0x95, 0x02,                   //   Report Count (2)
+    0x81, 0x02,                   //   Input (Data, Variable, Absolute)
+    0x85, HID_REPORT_PROFILE,     //   Report ID
+    0x09, 0x01,                   //   Usage (Start Position)
+    0x09, 0x02,                   //   Usage (End Position)
+    0x09, 0x03,                   //   Usage (Detents)
+    0x27, 0xff, 0xff, 0x00, 0x00, //   Logical Maximum (65535)
+    0x75, 0x10,                   //   Report Size (16)
+    0x95, 0x03,                   //   Report Count (3)
+    0xb1, 0x02,                   //   Feature (Data, Variable, Absolute)
+    0xc0,                         // End Collection
+};
+
+/**
+ * Fills input report 1: little endian position and CLOCK_MONOTONIC sample time
+ */
+static void motorknob_hid_fill_position(u8 *report, u16 position, u64 timestamp_ns) {
+    int i;
+
+    report[0] = HID_REPORT_POSITION;
+    report[1] = (u8) position;
+    report[2] = (u8) (position >> 8);
+    for (i = 0; i < 8; i++) {
+        report[3 + i] = (u8) (timestamp_ns >> (8 * i));
+    }
+}
+
+/**
+ * Publishes a new position to HID
+ */
+static void motorknob_hid_report(struct motorknob *mk, u16 position, ktime_t timestamp) {
+    u8 report[HID_POSITION_SIZE];
+
+    motorknob_hid_fill_position(report, position, ktime_to_ns(timestamp));
+
+    mutex_lock(&mk->hid_lock);
+    if (mk->hid) {
+        hid_input_report(mk->hid, HID_INPUT_REPORT, report, sizeof(report), 1);
+    }
+    mutex_unlock(&mk->hid_lock);
+}
+
+static int motorknob_hid_parse(struct hid_device *hid) {
+    return hid_parse_report(hid, motorknob_hid_report_desc, sizeof(motorknob_hid_report_desc));
+}
+
+static int motorknob_hid_start(struct hid_device *hid) {
+    return 0;
+}
+
+static void motorknob_hid_stop(struct hid_device *hid) {
+}
+
+/**
+ * Someone listens (hidraw, evdev), positions are needed from now on
+ */
+static int motorknob_hid_open(struct hid_device *hid) {
+    motorknob_sampler_get(hid->driver_data);
+    return 0;
+}
+
+static void motorknob_hid_close(struct hid_device *hid) {
+    motorknob_sampler_put(hid->driver_data);
+}
+
+/**
+ * Reads the profile registers into a feature report
+ * Queued together, so they merge into one block transfer if the firmware can
+ */
+static int motorknob_hid_get_profile(struct motorknob *mk, u8 *buf, size_t len) {
+    struct motorknob_request reqs[] = {
+        { .reg = DATA_START_POS },
+        { .reg = DATA_END_POS },
+        { .reg = DATA_DETENTS },
+    };
+    int i;
+
+    if (len < HID_PROFILE_SIZE) {
+        return -EINVAL;
+    }
+
+    motorknob_submit(mk, reqs, ARRAY_SIZE(reqs));
+
+    buf[0] = HID_REPORT_PROFILE;
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        if (reqs[i].result < 0) {
+            return reqs[i].result;
+        }
+        buf[1 + 2 * i] = (u8) reqs[i].word;
+        buf[2 + 2 * i] = (u8) (reqs[i].word >> 8);
+    }
+
+    return HID_PROFILE_SIZE;
+}
+
+/**
+ * Writes the profile registers from a feature report
+ */
+static int motorknob_hid_set_profile(struct motorknob *mk, const u8 *buf, size_t len) {
+    u16 values[PROFILE_REGISTERS];
+    int ret;
+    int i;
+
+    if (len < HID_PROFILE_SIZE) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < PROFILE_REGISTERS; i++) {
+        values[i] = buf[1 + 2 * i] | (buf[2 + 2 * i] << 8);
+    }
+
+    ret = motorknob_write_profile(mk, values);
+    return ret < 0 ? ret : HID_PROFILE_SIZE;
+}
+
+static int motorknob_hid_raw_request(struct hid_device *hid, unsigned char reportnum, u8 *buf,
+                                     size_t len, unsigned char rtype, int reqtype) {
+    struct motorknob *mk = hid->driver_data;
+    struct motorknob_sample sample;
+    s32 result;
+
+    switch (reportnum) {
+    case HID_REPORT_POSITION:
+        if (rtype != HID_INPUT_REPORT || reqtype != HID_REQ_GET_REPORT || len < HID_POSITION_SIZE) {
+            return -EINVAL;
+        }
+        result = motorknob_position(mk, 0, &sample);
+        if (result < 0) {
+            return result;
+        }
+        motorknob_hid_fill_position(buf, sample.position, sample.timestamp_ns);
+        return HID_POSITION_SIZE;
+
+    case HID_REPORT_PROFILE:
+        if (rtype != HID_FEATURE_REPORT) {
+            return -EINVAL;
+        }
+        if (reqtype == HID_REQ_GET_REPORT) {
+            return motorknob_hid_get_profile(mk, buf, len);
+        }
+        if (reqtype == HID_REQ_SET_REPORT) {
+            return motorknob_hid_set_profile(mk, buf, len);
+        }
+        return -EINVAL;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+static const struct hid_ll_driver motorknob_hid_ll_driver = {
+    .parse = motorknob_hid_parse,
+    .start = motorknob_hid_start,
+    .stop = motorknob_hid_stop,
+    .open = motorknob_hid_open,
+    .close = motorknob_hid_close,
+    .raw_request = motorknob_hid_raw_request,
+};
+
+/**
+ * Registers the virtual HID device
+ */
+static int setup_hid(struct motorknob *mk) {
+    struct i2c_client *client = mk->client;
+    struct hid_device *hid = hid_allocate_device();
+    int ret;
+
+    if (IS_ERR(hid)) {
+        return PTR_ERR(hid);
+    }
+
+    hid->ll_driver = &motorknob_hid_ll_driver;
+    hid->driver_data = mk;
+    hid->dev.parent = &client->dev;
+    hid->bus = BUS_I2C;
+    hid->vendor = 0x0000;
+    hid->product = 0x0000;
+    strscpy(hid->name, "MotorKnob", sizeof(hid->name));
+    snprintf(hid->phys, sizeof(hid->phys), "%s/input0", dev_name(&client->dev));
+
+    ret = hid_add_device(hid);
+    if (ret) {
+        hid_destroy_device(hid);
+        return ret;
+    }
+
+    mutex_lock(&mk->hid_lock);
+    mk->hid = hid;
+    mutex_unlock(&mk->hid_lock);
+    return 0;
+}
+
+static void destroy_hid(struct motorknob *mk) {
+    struct hid_device *hid;
+
+    // stop the sampler from feeding it first
+    mutex_lock(&mk->hid_lock);
+    hid = mk->hid;
+    mk->hid = NULL;
+    mutex_unlock(&mk->hid_lock);
+
+    if (hid) {
+        hid_destroy_device(hid);
+    }
+}
+
+/*
+ * Snapshot
+ * Latest positions of all Knobs in one call. A fresh snapshot reads all
+ * Knobs at once, one work item each, so Knobs on different buses
+ * transfer in parallel instead of one after another.
+ */
+#define SNAPSHOT_MAX 1024
+
+static DEFINE_MUTEX(motorknob_snapshot_lock);
+
+static void motorknob_snapshot_work(struct work_struct *work) {
+    struct motorknob *mk = container_of(work, struct motorknob, snapshot_work);
+    struct motorknob_sample sample;
+
+    motorknob_position(mk, 0, &sample);
+    complete(mk->snapshot_done);
+}
+
+/**
+ * Reads every Knob right now
+ * Caller holds motorknob_devices_lock
+ */
+static void motorknob_snapshot_refresh(void) {
+    struct motorknob *mk;
+    struct completion *done;
+    int count = 0;
+    int i = 0;
+
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        count++;
+    }
+
+    done = kcalloc(count, sizeof(*done), GFP_KERNEL);
+    if (!done) {
+        // still fine, just cached positions
+        return;
+    }
+
+    mutex_lock(&motorknob_snapshot_lock);
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        init_completion(&done[i]);
+        mk->snapshot_done = &done[i++];
+        queue_work(system_highpri_wq, &mk->snapshot_work);
+    }
+
+    for (i = 0; i < count; i++) {
+        wait_for_completion(&done[i]);
+    }
+    mutex_unlock(&motorknob_snapshot_lock);
+
+    kfree(done);
+}
+
+/**
+ * Copies up to max samples, returns the number of Knobs
+ * Caller holds motorknob_devices_lock
+ */
+static u32 motorknob_snapshot_fill(struct motorknob_sample *samples, u32 max) {
+    struct motorknob *mk;
+    u32 count = 0;
+
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        if (count < max) {
+            motorknob_latest_sample(mk, &samples[count]);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * History
+ * Late joiners get recent motion in one copy instead of polling it together.
+ */
+
+/**
+ * Copies up to count samples newer than since_ns, oldest first
+ * Returns the number copied
+ */
+static u32 motorknob_history_copy(struct motorknob *mk, u64 since_ns, struct motorknob_sample *samples,
+                                  u32 count, u32 *flags, u64 *head_out) {
+    u64 head, oldest, first, last, dropped_ns;
+    u32 copied, done, n;
+    unsigned int seq;
+    bool lost;
+
+again:
+    // timestamps only grow, find the first one after since_ns
+    do {
+        seq = read_seqbegin(&mk->sample_lock);
+        head = mk->history_head;
+        dropped_ns = mk->history_dropped_ns;
+        oldest = head > mk->history_mask ? head - mk->history_mask - 1 : 0;
+
+        first = oldest;
+        last = head;
+        while (first < last) {
+            u64 mid = first + (last - first) / 2;
+
+            if (mk->history[mid & mk->history_mask].timestamp_ns > since_ns) {
+                last = mid;
+            } else {
+                first = mid + 1;
+            }
+        }
+    } while (read_seqretry(&mk->sample_lock, seq));
+
+    *flags = 0;
+    if (since_ns && dropped_ns > since_ns) {
+        *flags |= MOTORKNOB_HISTORY_OVERRUN;
+    }
+
+    // in chunks, a long copy must not hold off the publishing bus thread
+    copied = min_t(u64, count, head - first);
+    for (done = 0; done < copied; done += n) {
+        u64 pos = first + done;
+
+        n = min_t(u32, copied - done, HISTORY_COPY_CHUNK);
+        do {
+            seq = read_seqbegin(&mk->sample_lock);
+            lost = mk->history_head - pos > mk->history_mask + 1;
+            for (u32 i = 0; !lost && i < n; i++) {
+                samples[done + i] = mk->history[(pos + i) & mk->history_mask];
+            }
+        } while (read_seqretry(&mk->sample_lock, seq));
+
+        // the ring lapped the copy, start over from what is left
+        if (lost) {
+            goto again;
+        }
+    }
+
+    *head_out = head;
+    return copied;
+}
+
+static long motorknob_ioctl_history(struct motorknob_file *mf, struct motorknob_history __user *arg) {
+    struct motorknob *mk = mf->mk;
+    struct motorknob_history history;
+    struct motorknob_sample *samples;
+    long ret = 0;
+    u64 head;
+
+    if (copy_from_user(&history, arg, sizeof(history))) {
+        return -EFAULT;
+    }
+
+    history.count = min(history.count, mk->history_mask + 1);
+    samples = kvcalloc(history.count, sizeof(*samples), GFP_KERNEL);
+    if (history.count && !samples) {
+        return -ENOMEM;
+    }
+
+    history.count = motorknob_history_copy(mk, history.since_ns, samples, history.count, &history.flags, &head);
+    WRITE_ONCE(mf->history_seen, head);
+    if (history.count) {
+        trace_motorknob_reader(mk->index, history.count, samples[history.count - 1].timestamp_ns, ktime_get_ns());
+    }
+
+    if (copy_to_user(u64_to_user_ptr(history.samples), samples, history.count * sizeof(*samples)) ||
+        copy_to_user(arg, &history, sizeof(history))) {
+        ret = -EFAULT;
+    }
+
+    kvfree(samples);
+    return ret;
+}
+
+/*
+ * Zones
+ */
+
+static void zones_free(struct motorknob_file_zones *z) {
+    if (!z) {
+        return;
+    }
+    if (z->eventfd) {
+        eventfd_ctx_put(z->eventfd);
+    }
+    kfree(z);
+}
+
+/**
+ * Takes the zones from userspace, inside starts from the latest position
+ */
+static struct motorknob_file_zones *zones_create(const struct motorknob_zones *args) {
+    struct motorknob_file_zones *z;
+    u32 i;
+
+    if (args->flags || args->count > MOTORKNOB_ZONES_MAX) {
+        return ERR_PTR(-EINVAL);
+    }
+
+    z = kzalloc(sizeof(*z), GFP_KERNEL);
+    if (!z) {
+        return ERR_PTR(-ENOMEM);
+    }
+
+    z->count = args->count;
+    if (copy_from_user(z->zones, u64_to_user_ptr(args->zones), z->count * sizeof(*z->zones))) {
+        kfree(z);
+        return ERR_PTR(-EFAULT);
+    }
+
+    for (i = 0; i < z->count; i++) {
+        u32 flags = z->zones[i].flags;
+
+        if (!flags || (flags & ~(MOTORKNOB_ZONE_ENTER | MOTORKNOB_ZONE_EXIT))) {
+            kfree(z);
+            return ERR_PTR(-EINVAL);
+        }
+    }
+
+    if (args->eventfd >= 0) {
+        z->eventfd = eventfd_ctx_fdget(args->eventfd);
+        if (IS_ERR(z->eventfd)) {
+            struct eventfd_ctx *err = z->eventfd;
+
+            kfree(z);
+            return ERR_CAST(err);
+        }
+    }
+
+    return z;
+}
+
+static long motorknob_ioctl_zones(struct motorknob_file *mf, struct motorknob_zones __user *arg) {
+    struct motorknob *mk = mf->mk;
+    struct motorknob_file_zones *z = NULL, *old;
+    struct motorknob_zones args;
+    struct motorknob_sample sample;
+    u64 head;
+
+    if (copy_from_user(&args, arg, sizeof(args))) {
+        return -EFAULT;
+    }
+
+    if (args.count) {
+        z = zones_create(&args);
+        if (IS_ERR(z)) {
+            return PTR_ERR(z);
+        }
+    }
+
+    // the latest position is taken under zone_lock, the next sample is checked against it
+    spin_lock(&mk->zone_lock);
+    if (z) {
+        motorknob_latest_sample_head(mk, &sample, &head);
+        if (sample.flags & MOTORKNOB_SAMPLE_VALID) {
+            z->inside = zones_inside(z, sample.position);
+            z->seq = head;
+        }
+    }
+
+    old = mf->zones;
+    mf->zones = z;
+    if (old && !z) {
+        list_del(&mf->zone_node);
+    } else if (!old && z) {
+        list_add_tail(&mf->zone_node, &mk->zone_files);
+    }
+    spin_unlock(&mk->zone_lock);
+
+    zones_free(old);
+
+    args.inside = z ? z->inside : 0;
+    if (copy_to_user(arg, &args, sizeof(args))) {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/**
+ * Takes the oldest event, false if there is none
+ */
+static bool motorknob_zone_event_pop(struct motorknob_file *mf, struct motorknob_zone_event *event) {
+    struct motorknob *mk = mf->mk;
+    struct motorknob_file_zones *z;
+    bool found = false;
+
+    spin_lock(&mk->zone_lock);
+    z = mf->zones;
+    if (z && z->tail != z->head) {
+        *event = z->events[z->tail++ % ZONE_EVENTS];
+        if (z->overrun) {
+            event->flags |= MOTORKNOB_ZONE_OVERRUN;
+            z->overrun = false;
+        }
+        found = true;
+    }
+    spin_unlock(&mk->zone_lock);
+
+    return found;
+}
+
+static bool motorknob_zone_pending(struct motorknob_file *mf) {
+    struct motorknob *mk = mf->mk;
+    bool pending;
+
+    spin_lock(&mk->zone_lock);
+    pending = mf->zones && mf->zones->tail != mf->zones->head;
+    spin_unlock(&mk->zone_lock);
+
+    return pending;
+}
+
+/**
+ * Returns zone events, blocks until there is one
+ */
+static ssize_t motorknob_read_file(struct file *file, char __user *buffer, size_t len, loff_t *offset) {
+    struct motorknob_file *mf = file->private_data;
+    struct motorknob *mk = mf->mk;
+    struct motorknob_zone_event event;
+    size_t copied = 0;
+    int ret;
+
+    if (len < sizeof(event)) {
+        return -EINVAL;
+    }
+
+    while (copied + sizeof(event) <= len) {
+        if (!motorknob_zone_event_pop(mf, &event)) {
+            if (copied) {
+                break;
+            }
+            if (!READ_ONCE(mf->zones)) {
+                return -EINVAL;
+            }
+            if (READ_ONCE(mk->gone)) {
+                return 0;
+            }
+            if (file->f_flags & O_NONBLOCK) {
+                return -EAGAIN;
+            }
+
+            ret = wait_event_interruptible(mf->zone_wait, motorknob_zone_pending(mf) || READ_ONCE(mk->gone));
+            if (ret) {
+                return ret;
+            }
+            continue;
+        }
+
+        if (copy_to_user(buffer + copied, &event, sizeof(event))) {
+            return copied ? copied : -EFAULT;
+        }
+        copied += sizeof(event);
+    }
+
+    return copied;
+}
+
+/*
+ * Trigger
+ */
+
+static int motorknob_trigger_get(struct motorknob_trigger __user *arg, struct motorknob_trigger *trigger) {
+    if (copy_from_user(trigger, arg, sizeof(*trigger))) {
+        return -EFAULT;
+    }
+    if (trigger->flags || trigger->reserved) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * Keeps the Knob from going away while a file talks to it
+ * Returns false once it is gone
+ */
+static bool motorknob_file_io_begin(struct motorknob *mk) {
+    down_read(&mk->file_io);
+    if (mk->gone) {
+        up_read(&mk->file_io);
+        return false;
+    }
+    return true;
+}
+
+static void motorknob_file_io_end(struct motorknob *mk) {
+    up_read(&mk->file_io);
+}
+
+static long motorknob_ioctl_position(struct motorknob_file *mf, struct motorknob_position __user *arg) {
+    struct motorknob_position position;
+    int ret;
+
+    if (copy_from_user(&position, arg, sizeof(position))) {
+        return -EFAULT;
+    }
+
+    if (!motorknob_file_io_begin(mf->mk)) {
+        return -ENODEV;
+    }
+    ret = motorknob_position(mf->mk, position.max_age_ns, &position.sample);
+    motorknob_file_io_end(mf->mk);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (copy_to_user(arg, &position, sizeof(position))) {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/*
+ * Profile contexts
+ * Every open file can carry its own profile, the focused one is on the Knob.
+ * A focus change writes all profile registers as one batch, or nothing if
+ * the Knob has that profile already, instead of clients racing on the profile files.
+ */
+
+/**
+ * Puts the profile of a context on the Knob, nothing if it is there already
+ * Caller holds mk->lock
+ */
+static int motorknob_context_apply(struct motorknob *mk, const struct motorknob_context *context) {
+    u16 values[PROFILE_REGISTERS] = {
+        [DATA_START_POS] = context->start_position,
+        [DATA_END_POS] = context->end_position,
+        [DATA_DETENTS] = context->detents,
+    };
+    const struct motorknob_profile *profile;
+    bool same;
+
+    rcu_read_lock();
+    profile = rcu_dereference(mk->profile);
+    same = profile->valid == GENMASK(PROFILE_REGISTERS - 1, 0) && !memcmp(profile->values, values, sizeof(values));
+    rcu_read_unlock();
+
+    if (same) {
+        mk->context_skipped++;
+        return 0;
+    }
+
+    mk->context_switches++;
+    return motorknob_write_profile(mk, values);
+}
+
+/**
+ * Sets the profile context of a file, the Knob gets it right away if the file has the focus
+ */
+static long motorknob_ioctl_context(struct file *file, struct motorknob_file *mf, struct motorknob_context __user *arg) {
+    struct motorknob *mk = mf->mk;
+    struct motorknob_context context;
+    long ret = 0;
+
+    if (!(file->f_mode & FMODE_WRITE)) {
+        return -EBADF;
+    }
+    if (copy_from_user(&context, arg, sizeof(context))) {
+        return -EFAULT;
+    }
+    if (context.reserved) {
+        return -EINVAL;
+    }
+
+    if (!motorknob_file_io_begin(mk)) {
+        return -ENODEV;
+    }
+
+    mutex_lock(&mk->lock);
+    if (mk->focus == mf) {
+        ret = motorknob_context_apply(mk, &context);
+    }
+    if (!ret) {
+        mf->context = context;
+        mf->has_context = true;
+    }
+    mutex_unlock(&mk->lock);
+
+    motorknob_file_io_end(mk);
+    return ret;
+}
+
+/**
+ * Gives a file the focus, the Knob switches to its profile context
+ * The focus stays until another file takes it or the file is closed.
+ */
+static long motorknob_ioctl_focus(struct file *file, struct motorknob_file *mf) {
+    struct motorknob *mk = mf->mk;
+    long ret = 0;
+
+    if (!(file->f_mode & FMODE_WRITE)) {
+        return -EBADF;
+    }
+
+    if (!motorknob_file_io_begin(mk)) {
+        return -ENODEV;
+    }
+
+    mutex_lock(&mk->lock);
+    if (!mf->has_context) {
+        ret = -ENODATA;
+    } else if (mk->focus != mf) {
+        ret = motorknob_context_apply(mk, &mf->context);
+        if (!ret) {
+            mk->focus = mf;
+        }
+    }
+    mutex_unlock(&mk->lock);
+
+    motorknob_file_io_end(mk);
+    return ret;
+}
+
+static long motorknob_ioctl_trigger(struct motorknob_file *mf, struct motorknob_trigger __user *arg) {
+    struct motorknob_trigger trigger;
+    int ret = motorknob_trigger_get(arg, &trigger);
+
+    if (ret) {
+        return ret;
+    }
+
+    motorknob_sampler_arm(mf->mk, trigger.at_ns);
+    return 0;
+}
+
+/*
+ * Sequencer
+ * Runs register writes at given CLOCK_MONOTONIC times, for haptic choreography
+ * that has to line up with audio or video. A hard hrtimer wakes a SCHED_FIFO
+ * worker that writes right away, past the request queue and its window.
+ * Every command reports how late it started, the timer and wakeup latency.
+ */
+#define SEQUENCE_COMMANDS_MAX 4096
+
+// from 6.14 kthread_create_worker no longer starts the thread
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+#define motorknob_run_worker(name) kthread_run_worker(0, name)
+#else
+#define motorknob_run_worker(name) kthread_create_worker(0, name)
+#endif
+
+static struct kthread_worker *motorknob_seq_worker;
+
+struct motorknob_sequence_run {
+    struct hrtimer timer;
+    struct kthread_work work;
+    struct list_head node; // in mk->sequences
+    struct motorknob *mk;
+    struct motorknob_command *commands;
+    u32 count;
+    u32 next;              // first command not run yet, only the worker touches it
+    int cancelled;         // 0, or what the commands not run yet get
+    struct completion done;
+};
+
+static enum hrtimer_restart motorknob_sequence_timer(struct hrtimer *timer) {
+    struct motorknob_sequence_run *run = container_of(timer, struct motorknob_sequence_run, timer);
+
+    kthread_queue_work(motorknob_seq_worker, &run->work);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * Writes every command that is due, arms the timer for the next one
+ */
+static void motorknob_sequence_work(struct kthread_work *work) {
+    struct motorknob_sequence_run *run = container_of(work, struct motorknob_sequence_run, work);
+
+    while (run->next < run->count) {
+        struct motorknob_command *cmd = &run->commands[run->next];
+        int cancelled = READ_ONCE(run->cancelled);
+        struct motorknob_request req;
+        u64 now;
+
+        if (cancelled) {
+            for (; run->next < run->count; run->next++) {
+                run->commands[run->next].result = cancelled;
+            }
+            break;
+        }
+
+        now = ktime_get_ns();
+        if (cmd->at_ns > now) {
+            hrtimer_start(&run->timer, ns_to_ktime(cmd->at_ns), HRTIMER_MODE_ABS_HARD);
+            return;
+        }
+
+        // through the queue like everyone else, a batch in flight goes first
+        cmd->error_ns = now - cmd->at_ns;
+        req = (struct motorknob_request) {
+            .reg = cmd->reg,
+            .write = true,
+            .word = cmd->value,
+        };
+        motorknob_submit_window(run->mk, &req, 1, false);
+        cmd->result = req.result;
+        run->next++;
+    }
+
+    complete(&run->done);
+}
+
+/**
+ * Stops a sequence early, the commands not run yet get reason
+ */
+static void motorknob_sequence_cancel(struct motorknob_sequence_run *run, int reason) {
+    cmpxchg(&run->cancelled, 0, reason);
+    kthread_queue_work(motorknob_seq_worker, &run->work);
+}
+
+/**
+ * Runs a sequence and returns once every command ran or it was cancelled
+ * Returns 0 or the result of the first command that failed or did not run.
+ */
+static long motorknob_ioctl_sequence(struct file *file, struct motorknob_file *mf, struct motorknob_sequence __user *arg) {
+    struct motorknob *mk = mf->mk;
+    struct motorknob_queue *q = &mk->queue;
+    struct motorknob_command __user *ucommands;
+    struct motorknob_sequence_run *run;
+    struct motorknob_sequence sequence;
+    long ret = 0;
+    u32 i;
+
+    if (!(file->f_mode & FMODE_WRITE)) {
+        return -EBADF;
+    }
+    if (copy_from_user(&sequence, arg, sizeof(sequence))) {
+        return -EFAULT;
+    }
+    if (sequence.flags || !sequence.count || sequence.count > SEQUENCE_COMMANDS_MAX) {
+        return -EINVAL;
+    }
+
+    run = kzalloc(sizeof(*run), GFP_KERNEL);
+    if (!run) {
+        return -ENOMEM;
+    }
+    run->commands = kvmalloc_array(sequence.count, sizeof(*run->commands), GFP_KERNEL);
+    if (!run->commands) {
+        kfree(run);
+        return -ENOMEM;
+    }
+
+    ucommands = u64_to_user_ptr(sequence.commands);
+    if (copy_from_user(run->commands, ucommands, sequence.count * sizeof(*run->commands))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    // same registers io_uring may write, in time order
+    for (i = 0; i < sequence.count; i++) {
+        struct motorknob_command *cmd = &run->commands[i];
+
+        if (cmd->reserved || !(cmd->reg < PROFILE_REGISTERS || cmd->reg == DATA_TORQUE)
+            || (i && cmd->at_ns < run->commands[i - 1].at_ns)) {
+            ret = -EINVAL;
+            goto out;
+        }
+        cmd->result = 0;
+        cmd->error_ns = 0;
+    }
+
+    run->mk = mk;
+    run->count = sequence.count;
+    init_completion(&run->done);
+    kthread_init_work(&run->work, motorknob_sequence_work);
+    motorknob_hrtimer_setup(&run->timer, motorknob_sequence_timer, HRTIMER_MODE_ABS_HARD);
+
+    // destroy_chardev cancels sequences listed here, none may start after it
+    spin_lock(&q->lock);
+    if (mk->gone) {
+        spin_unlock(&q->lock);
+        ret = -ENODEV;
+        goto out;
+    }
+    list_add_tail(&run->node, &mk->sequences);
+    spin_unlock(&q->lock);
+
+    kthread_queue_work(motorknob_seq_worker, &run->work);
+    if (wait_for_completion_interruptible(&run->done)) {
+        motorknob_sequence_cancel(run, -EINTR);
+        wait_for_completion(&run->done);
+    }
+
+    // a cancel can leave the timer armed and the work queued once more
+    hrtimer_cancel(&run->timer);
+    kthread_cancel_work_sync(&run->work);
+
+    spin_lock(&q->lock);
+    list_del(&run->node);
+    spin_unlock(&q->lock);
+    wake_up_all(&q->wait);
+
+    for (i = 0; i < run->count && !ret; i++) {
+        ret = run->commands[i].result;
+    }
+    if (copy_to_user(ucommands, run->commands, run->count * sizeof(*run->commands))) {
+        ret = -EFAULT;
+    }
+
+out:
+    kvfree(run->commands);
+    kfree(run);
+    return ret;
+}
+
+static int motorknob_open(struct inode *inode, struct file *file) {
+    struct motorknob *mk = container_of(file->private_data, struct motorknob, miscdev);
+    struct motorknob_file *mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+
+    if (!mf) {
+        return -ENOMEM;
+    }
+
+    // misc_open holds the misc lock, remove cannot run in between
+    kobject_get(&mk->kobj);
+    mf->mk = mk;
+    mf->history_seen = READ_ONCE(mk->history_head);
+    init_waitqueue_head(&mf->zone_wait);
+    file->private_data = mf;
+
+    return nonseekable_open(inode, file);
+}
+
+static int motorknob_release_file(struct inode *inode, struct file *file) {
+    struct motorknob_file *mf = file->private_data;
+    struct motorknob *mk = mf->mk;
+
+    spin_lock(&mk->zone_lock);
+    if (mf->zones) {
+        list_del(&mf->zone_node);
+    }
+    spin_unlock(&mk->zone_lock);
+    zones_free(mf->zones);
+
+    // the Knob keeps the profile, the next focus replaces it
+    mutex_lock(&mk->lock);
+    if (mk->focus == mf) {
+        mk->focus = NULL;
+    }
+    mutex_unlock(&mk->lock);
+
+    kobject_put(&mk->kobj);
+    kfree(mf);
+    return 0;
+}
+
+/**
+ * Readable when samples arrived since the last history call
+ * Priority data when zone events are waiting to be read
+ */
+static __poll_t motorknob_poll(struct file *file, poll_table *wait) {
+    struct motorknob_file *mf = file->private_data;
+    struct motorknob *mk = mf->mk;
+
+    __poll_t mask = 0;
+
+    poll_wait(file, &mk->history_wait, wait);
+    poll_wait(file, &mf->zone_wait, wait);
+
+    if (READ_ONCE(mk->gone)) {
+        return EPOLLHUP | EPOLLERR;
+    }
+    if (READ_ONCE(mk->history_head) != READ_ONCE(mf->history_seen)) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (motorknob_zone_pending(mf)) {
+        mask |= EPOLLPRI;
+    }
+
+    return mask;
+}
+
+static long motorknob_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct motorknob_file *mf = file->private_data;
+
+    switch (cmd) {
+    case MOTORKNOB_IOC_HISTORY:
+        return motorknob_ioctl_history(mf, (struct motorknob_history __user *) arg);
+    case MOTORKNOB_IOC_ZONES:
+        return motorknob_ioctl_zones(mf, (struct motorknob_zones __user *) arg);
+    case MOTORKNOB_IOC_TRIGGER:
+        return motorknob_ioctl_trigger(mf, (struct motorknob_trigger __user *) arg);
+    case MOTORKNOB_IOC_POSITION:
+        return motorknob_ioctl_position(mf, (struct motorknob_position __user *) arg);
+    case MOTORKNOB_IOC_CONTEXT:
+        return motorknob_ioctl_context(file, mf, (struct motorknob_context __user *) arg);
+    case MOTORKNOB_IOC_FOCUS:
+        return motorknob_ioctl_focus(file, mf);
+    case MOTORKNOB_IOC_SEQUENCE:
+        return motorknob_ioctl_sequence(file, mf, (struct motorknob_sequence __user *) arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * io_uring
+ * IORING_OP_URING_CMD on /dev/motorknobN runs a batch of register reads and
+ * writes on motorknob_wq and completes with a CQE, so an io_uring based daemon
+ * never blocks on the bus. The ops of a batch are queued together, profile
+ * writes in one batch go out as one block transfer.
+ */
+#define URING_OPS_MAX 64
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define uring_cmd_payload(ioucmd) ((const void *) (ioucmd)->sqe->cmd)
+#else
+#define uring_cmd_payload(ioucmd) ((ioucmd)->cmd)
+#endif
+
+static struct workqueue_struct *motorknob_wq;
+
+struct motorknob_uring_work {
+    struct work_struct work;
+    struct io_uring_cmd *ioucmd;
+    struct motorknob *mk;
+    struct motorknob_op __user *uops;
+    u32 count;
+    struct motorknob_request reqs[];
+};
+
+static struct motorknob_uring_work *uring_work(struct io_uring_cmd *ioucmd) {
+    return *(struct motorknob_uring_work **) ioucmd->pdu;
+}
+
+/**
+ * Whether userspace may do this op, read and write only what sysfs and HID could
+ * DATA_DELTA is not readable, it would steal motion from relative mode
+ */
+static int motorknob_uring_op_check(const struct motorknob_op *op, struct file *file) {
+    if (op->flags & ~MOTORKNOB_OP_WRITE) {
+        return -EINVAL;
+    }
+
+    if (op->flags & MOTORKNOB_OP_WRITE) {
+        if (!(file->f_mode & FMODE_WRITE)) {
+            return -EBADF;
+        }
+        return op->reg < PROFILE_REGISTERS || op->reg == DATA_TORQUE ? 0 : -EINVAL;
+    }
+
+    return op->reg <= DATA_CURRENT_POS || op->reg == DATA_CAPS ? 0 : -EINVAL;
+}
+
+/**
+ * Runs in the submitting task, copies the results back and posts the CQE
+ * The CQE result is 0 or the error of the first failed op
+ */
+static void motorknob_uring_complete(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    struct motorknob_uring_work *uw = uring_work(ioucmd);
+    int ret = 0;
+    u32 i;
+
+    for (i = 0; i < uw->count; i++) {
+        struct motorknob_request *req = &uw->reqs[i];
+        struct motorknob_op op = {
+            .reg = req->reg,
+            .flags = req->write ? MOTORKNOB_OP_WRITE : 0,
+            .value = req->word,
+            .result = req->result < 0 ? req->result : 0,
+        };
+
+        if (copy_to_user(&uw->uops[i], &op, sizeof(op))) {
+            ret = -EFAULT;
+            break;
+        }
+        if (!ret && op.result < 0) {
+            ret = op.result;
+        }
+    }
+
+    kvfree(uw);
+    io_uring_cmd_done(ioucmd, ret, 0, issue_flags);
+}
+
+static void motorknob_uring_run(struct work_struct *work) {
+    struct motorknob_uring_work *uw = container_of(work, struct motorknob_uring_work, work);
+    struct motorknob_queue *q = &uw->mk->queue;
+
+    motorknob_submit(uw->mk, uw->reqs, uw->count);
+
+    spin_lock(&q->lock);
+    if (!--q->uring_inflight) {
+        wake_up_all(&q->wait);
+    }
+    spin_unlock(&q->lock);
+
+    io_uring_cmd_complete_in_task(uw->ioucmd, motorknob_uring_complete);
+}
+
+static int motorknob_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    const struct motorknob_uring_batch *cmd = uring_cmd_payload(ioucmd);
+    struct motorknob_file *mf = ioucmd->file->private_data;
+    struct motorknob *mk = mf->mk;
+    struct motorknob_queue *q = &mk->queue;
+    struct motorknob_uring_work *uw;
+    u64 ops;
+    u32 count, i;
+    int ret;
+
+    if (ioucmd->cmd_op != MOTORKNOB_URING_CMD_BATCH) {
+        return -ENOTTY;
+    }
+
+    // the SQE is shared with userspace, read it once
+    ops = READ_ONCE(cmd->ops);
+    count = READ_ONCE(cmd->count);
+    if (READ_ONCE(cmd->flags) || !count || count > URING_OPS_MAX) {
+        return -EINVAL;
+    }
+
+    uw = kvzalloc(struct_size(uw, reqs, count), GFP_KERNEL);
+    if (!uw) {
+        return -ENOMEM;
+    }
+    uw->ioucmd = ioucmd;
+    uw->mk = mk;
+    uw->uops = u64_to_user_ptr(ops);
+    uw->count = count;
+    INIT_WORK(&uw->work, motorknob_uring_run);
+
+    for (i = 0; i < count; i++) {
+        struct motorknob_op op;
+
+        if (copy_from_user(&op, &uw->uops[i], sizeof(op))) {
+            ret = -EFAULT;
+            goto err;
+        }
+        ret = motorknob_uring_op_check(&op, ioucmd->file);
+        if (ret < 0) {
+            goto err;
+        }
+
+        uw->reqs[i].reg = op.reg;
+        uw->reqs[i].write = op.flags & MOTORKNOB_OP_WRITE;
+        uw->reqs[i].word = op.value;
+    }
+
+    // destroy_chardev waits for batches counted here, none may start after it
+    spin_lock(&q->lock);
+    if (mk->gone) {
+        spin_unlock(&q->lock);
+        ret = -ENODEV;
+        goto err;
+    }
+    q->uring_inflight++;
+    spin_unlock(&q->lock);
+
+    *(struct motorknob_uring_work **) ioucmd->pdu = uw;
+    queue_work(motorknob_wq, &uw->work);
+    return -EIOCBQUEUED;
+
+err:
+    kvfree(uw);
+    return ret;
+}
+
+static const struct file_operations motorknob_fops = {
+    .owner = THIS_MODULE,
+    .open = motorknob_open,
+    .release = motorknob_release_file,
+    .read = motorknob_read_file,
+    .poll = motorknob_poll,
+    .unlocked_ioctl = motorknob_ioctl,
+    .uring_cmd = motorknob_uring_cmd,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = noop_llseek,
+};
+
+/**
+ * Creates /dev/motorknobN
+ */
+static int setup_chardev(struct motorknob *mk) {
+    snprintf(mk->miscdev_name, sizeof(mk->miscdev_name), "motorknob%d", mk->index);
+
+    mk->miscdev.minor = MISC_DYNAMIC_MINOR;
+    mk->miscdev.name = mk->miscdev_name;
+    mk->miscdev.fops = &motorknob_fops;
+    mk->miscdev.parent = &mk->client->dev;
+    // like the sysfs files, writes (io_uring, contexts, sequences) need a file opened for writing
+    mk->miscdev.mode = 0664;
+
+    return misc_register(&mk->miscdev);
+}
+
+static void destroy_chardev(struct motorknob *mk) {
+    struct motorknob_queue *q = &mk->queue;
+    struct motorknob_sequence_run *run;
+    struct motorknob_file *mf;
+
+    misc_deregister(&mk->miscdev);
+
+    // files still open only see history from now on
+    down_write(&mk->file_io);
+    spin_lock(&q->lock);
+    WRITE_ONCE(mk->gone, true);
+    list_for_each_entry(run, &mk->sequences, node) {
+        motorknob_sequence_cancel(run, -ENODEV);
+    }
+    spin_unlock(&q->lock);
+    up_write(&mk->file_io);
+    wake_up_interruptible(&mk->history_wait);
+
+    spin_lock(&mk->zone_lock);
+    list_for_each_entry(mf, &mk->zone_files, zone_node) {
+        wake_up_interruptible(&mf->zone_wait);
+    }
+    spin_unlock(&mk->zone_lock);
+
+    // io_uring batches already queued still need the client
+    wait_event(q->wait, !READ_ONCE(q->uring_inflight));
+    wait_event(q->wait, list_empty_careful(&mk->sequences));
+}
+
+/**
+ * Reads detents from Knob
+ */
+static ssize_t read_detents(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return motorknob_read(to_motorknob(kobj), DATA_DETENTS, buffer);
+}
+
+/**
+ * Writes number of detents
+ */
+static ssize_t write_detents(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    return motorknob_write(to_motorknob(kobj), WRITE_DETENTS, buffer, count);
+}
+
+/**
+ * Reads start position from Knob
+ */
+static ssize_t read_start_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return motorknob_read(to_motorknob(kobj), DATA_START_POS, buffer);
+}
+
+/**
+ * Writes new start position
+ */
+static ssize_t write_start_position(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    return motorknob_write(to_motorknob(kobj), WRITE_START_POS, buffer, count);
+}
+
+/**
+ * Reads end position from Knob
+ */
+static ssize_t read_end_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return motorknob_read(to_motorknob(kobj), DATA_END_POS, buffer);
+}
+
+/**
+ * Writes new end position
+ */
+static ssize_t write_end_position(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    return motorknob_write(to_motorknob(kobj), WRITE_END_POS, buffer, count);
+}
+
+/**
+ * Reads position from Knob
+ */
+static ssize_t read_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_sample sample;
+    int ret = motorknob_position(mk, (u64) READ_ONCE(mk->max_age_us) * NSEC_PER_USEC, &sample);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    buffer[0] = (u8) sample.position;
+    buffer[1] = (u8) (sample.position >> 8);
+
+    return 2;
+}
+
+/**
+ * Reads how old a position may be before reading position asks the Knob, in us
+ */
+static ssize_t read_max_age(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%u\n", READ_ONCE(to_motorknob(kobj)->max_age_us));
+}
+
+/**
+ * Writes the maximum age in us, 0 always reads (but still shares reads with concurrent readers)
+ */
+static ssize_t write_max_age(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    unsigned int max_age_us;
+    int ret = kstrtouint(buffer, 0, &max_age_us);
+
+    if (ret) {
+        return ret;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->max_age_us, max_age_us);
+    return count;
+}
+
+/**
+ * Reads the sample rate in Hz
+ */
+static ssize_t read_sample_rate(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%lld\n", NSEC_PER_SEC / ktime_to_ns(READ_ONCE(to_motorknob(kobj)->sampler.period)));
+}
+
+/**
+ * Writes a new sample rate in Hz, takes effect with the next tick
+ */
+static ssize_t write_sample_rate(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    unsigned int rate;
+    int ret = kstrtouint(buffer, 0, &rate);
+
+    if (ret) {
+        return ret;
+    }
+    if (rate == 0 || rate > SAMPLE_RATE_MAX) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->sampler.period, ns_to_ktime(NSEC_PER_SEC / rate));
+    return count;
+}
+
+/**
+ * Reads how long before the trigger time a triggered read starts in us
+ */
+static ssize_t read_trigger_offset(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%u\n", READ_ONCE(to_motorknob(kobj)->sampler.trigger_offset_us));
+}
+
+/**
+ * Writes the trigger offset in us, about the sampler/latency of this Knob is a good start
+ */
+static ssize_t write_trigger_offset(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    unsigned int offset_us;
+    int ret = kstrtouint(buffer, 0, &offset_us);
+
+    if (ret) {
+        return ret;
+    }
+    if (offset_us > TRIGGER_OFFSET_MAX) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->sampler.trigger_offset_us, offset_us);
+    return count;
+}
+
+static const char * const mode_names[] = { "absolute", "relative" };
+
+/**
+ * Reads the sampling mode
+ */
+static ssize_t read_mode(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%s\n", mode_names[READ_ONCE(to_motorknob(kobj)->relative)]);
+}
+
+/**
+ * Switches between absolute and relative sampling
+ * Relative starts from a fresh base with a cleared delta, absolute continues from the last one
+ */
+static ssize_t write_mode(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    int mode = sysfs_match_string(mode_names, buffer);
+    s32 result = 0;
+
+    if (mode < 0) {
+        return mode;
+    }
+    if (mode && !(mk->caps & CAP_DELTA)) {
+        return -EOPNOTSUPP;
+    }
+
+    mutex_lock(&mk->lock);
+    mutex_lock(&mk->sample_mutex);
+    if (mode && !mk->relative) {
+        result = motorknob_sampler_rebase(mk, true);
+    } else {
+        WRITE_ONCE(mk->relative, mode);
+    }
+    mutex_unlock(&mk->sample_mutex);
+    mutex_unlock(&mk->lock);
+
+    return result < 0 ? result : count;
+}
+
+/**
+ * Reads how old the latest known position is in ns
+ * Counted from the interrupt if the Knob has one, from the start of the read otherwise
+ */
+static ssize_t read_age(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_sample sample;
+
+    motorknob_latest_sample(to_motorknob(kobj), &sample);
+    if (!(sample.flags & MOTORKNOB_SAMPLE_VALID)) {
+        return -ENODATA;
+    }
+
+    return sysfs_emit(buffer, "%llu\n", ktime_get_ns() - sample.timestamp_ns);
+}
+
+/**
+ * Reads the total motion seen by the sampler
+ */
+static ssize_t read_accumulated(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%lld\n", READ_ONCE(to_motorknob(kobj)->accumulated));
+}
+
+/**
+ * Reads whether sampling is forced on
+ */
+static ssize_t read_sample_enabled(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%d\n", READ_ONCE(to_motorknob(kobj)->sampler.forced));
+}
+
+/**
+ * Keeps the sampler running without any other user, e.g. to fill the history
+ */
+static ssize_t write_sample_enabled(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    bool enable;
+    int ret = kstrtobool(buffer, &enable);
+
+    if (ret) {
+        return ret;
+    }
+
+    mutex_lock(&mk->lock);
+    if (enable != mk->sampler.forced) {
+        WRITE_ONCE(mk->sampler.forced, enable);
+        if (enable) {
+            motorknob_sampler_get(mk);
+        } else {
+            motorknob_sampler_put(mk);
+        }
+    }
+    mutex_unlock(&mk->lock);
+
+    return count;
+}
+
+/**
+ * Reads loop period jitter statistics in ns
+ */
+static ssize_t read_sample_jitter(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+    u64 loops, abs_sum;
+    s64 min, max;
+
+    spin_lock(&sampler->stats_lock);
+    loops = sampler->loops;
+    abs_sum = sampler->jitter_abs_sum;
+    min = sampler->jitter_min;
+    max = sampler->jitter_max;
+    spin_unlock(&sampler->stats_lock);
+
+    return sysfs_emit(buffer, "loops=%llu min=%lld max=%lld mean_abs=%llu overruns=%llu\n",
+                      loops, min, max, loops ? div64_u64(abs_sum, loops) : 0, READ_ONCE(sampler->overruns));
+}
+
+/**
+ * Any write resets the jitter statistics
+ */
+static ssize_t write_sample_jitter(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+
+    spin_lock(&sampler->stats_lock);
+    sampler->loops = 0;
+    sampler->jitter_abs_sum = 0;
+    sampler->jitter_min = 0;
+    sampler->jitter_max = 0;
+    WRITE_ONCE(sampler->overruns, 0);
+    spin_unlock(&sampler->stats_lock);
+
+    return count;
+}
+
+/**
+ * Reads tick to sample latency statistics in ns, how long Knobs wait for their bus
+ */
+static ssize_t read_sample_latency(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+    u64 count, sum, max;
+
+    spin_lock(&sampler->stats_lock);
+    count = sampler->latency_count;
+    sum = sampler->latency_sum;
+    max = sampler->latency_max;
+    spin_unlock(&sampler->stats_lock);
+
+    return sysfs_emit(buffer, "samples=%llu mean=%llu max=%llu\n", count, count ? div64_u64(sum, count) : 0, max);
+}
+
+/**
+ * Any write resets the latency statistics
+ */
+static ssize_t write_sample_latency(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+
+    spin_lock(&sampler->stats_lock);
+    sampler->latency_count = 0;
+    sampler->latency_sum = 0;
+    sampler->latency_max = 0;
+    spin_unlock(&sampler->stats_lock);
+
+    return count;
+}
+
+/**
+ * Reads trigger to sample latency statistics in ns, of reads asked for by triggers and links
+ */
+static ssize_t read_sample_triggered(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+    u64 count, sum, max;
+
+    spin_lock(&sampler->stats_lock);
+    count = sampler->triggered_count;
+    sum = sampler->triggered_sum;
+    max = sampler->triggered_max;
+    spin_unlock(&sampler->stats_lock);
+
+    return sysfs_emit(buffer, "samples=%llu mean=%llu max=%llu\n", count, count ? div64_u64(sum, count) : 0, max);
+}
+
+/**
+ * Any write resets the triggered read statistics
+ */
+static ssize_t write_sample_triggered(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_sampler *sampler = &to_motorknob(kobj)->sampler;
+
+    spin_lock(&sampler->stats_lock);
+    sampler->triggered_count = 0;
+    sampler->triggered_sum = 0;
+    sampler->triggered_max = 0;
+    spin_unlock(&sampler->stats_lock);
+
+    return count;
+}
+
+/**
+ * Reads the bus thread this Knob is sampled by and how often it switched mux channels
+ */
+static ssize_t read_sample_bus(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_bus *bus = to_motorknob(kobj)->sampler.bus;
+    int knobs;
+
+    mutex_lock(&motorknob_buses_lock);
+    knobs = bus->knobs;
+    mutex_unlock(&motorknob_buses_lock);
+
+    return sysfs_emit(buffer, "i2c-%d knobs=%d samples=%llu channel_switches=%llu\n", bus->root->nr, knobs,
+                      READ_ONCE(bus->samples), READ_ONCE(bus->channel_switches));
+}
+
+/**
+ * Reads whether the control loop is running
+ */
+static ssize_t read_control_enabled(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%d\n", READ_ONCE(to_motorknob(kobj)->control.enabled));
+}
+
+/**
+ * Starts or stops the control loop
+ * Walls need start and end position, they get fetched once if never seen before
+ */
+static ssize_t write_control_enabled(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    bool enable;
+    int ret = kstrtobool(buffer, &enable);
+
+    if (ret) {
+        return ret;
+    }
+
+    mutex_lock(&mk->lock);
+    if (enable == mk->control.enabled) {
+        goto out;
+    }
+
+    if (enable) {
+        if (!motorknob_profile_known(mk, DATA_START_POS)) {
+            motorknob_read_word(mk, DATA_START_POS);
+        }
+        if (!motorknob_profile_known(mk, DATA_END_POS)) {
+            motorknob_read_word(mk, DATA_END_POS);
+        }
+
+        WRITE_ONCE(mk->control.enabled, true);
+        motorknob_sampler_get(mk);
+    } else {
+        WRITE_ONCE(mk->control.enabled, false);
+        motorknob_sampler_put(mk);
+
+        // let go of the knob, after a sample still in flight wrote its torque
+        mutex_lock(&mk->sample_mutex);
+        motorknob_write_word(mk, WRITE_TORQUE, 0);
+        mutex_unlock(&mk->sample_mutex);
+    }
+
+out:
+    mutex_unlock(&mk->lock);
+    return count;
+}
+
+// bounds of the control tunables, sysfs and restored state alike
+#define CONTROL_STIFFNESS_MAX (1 << 20)
+#define CONTROL_FRICTION_MAX  S16_MAX
+#define CONTROL_CENTER_MAX    U16_MAX
+#define CONTROL_TORQUE_MAX    S16_MAX
+
+// plain integer tunables of the control loop
+#define CONTROL_ATTR(_name, _min, _max)                                                                 \
+static ssize_t read_control_##_name(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) { \
+    return sysfs_emit(buffer, "%d\n", READ_ONCE(to_motorknob(kobj)->control._name));                    \
+}                                                                                                       \
+static ssize_t write_control_##_name(struct kobject *kobj, struct kobj_attribute *attr,                \
+                                     const char *buffer, size_t count) {                                \
+    int value;                                                                                          \
+    int ret = kstrtoint(buffer, 0, &value);                                                             \
+    if (ret) {                                                                                          \
+        return ret;                                                                                     \
+    }                                                                                                   \
+    if (value < (_min) || value > (_max)) {                                                             \
+        return -EINVAL;                                                                                 \
+    }                                                                                                   \
+    WRITE_ONCE(to_motorknob(kobj)->control._name, value);                                               \
+    return count;                                                                                       \
+}                                                                                                       \
+static struct kobj_attribute control_##_name##_attr = __ATTR(_name, 0660, read_control_##_name, write_control_##_name)
+
+CONTROL_ATTR(wall_stiffness, 0, CONTROL_STIFFNESS_MAX);
+CONTROL_ATTR(friction, 0, CONTROL_FRICTION_MAX);
+CONTROL_ATTR(spring_stiffness, 0, CONTROL_STIFFNESS_MAX);
+CONTROL_ATTR(spring_center, 0, CONTROL_CENTER_MAX);
+CONTROL_ATTR(torque_limit, 0, CONTROL_TORQUE_MAX);
+
+/**
+ * Reads whether both Knob and adapter support PEC
+ */
+static ssize_t read_pec_available(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%d\n", to_motorknob(kobj)->pec.available);
+}
+
+/**
+ * Reads the PEC policy for position reads
+ */
+static ssize_t read_pec_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%s\n", pec_policy_names[READ_ONCE(to_motorknob(kobj)->pec.position_policy)]);
+}
+
+/**
+ * Writes the PEC policy for position reads: off, on or auto
+ */
+static ssize_t write_pec_position(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    int policy = sysfs_match_string(pec_policy_names, buffer);
+
+    if (policy < 0) {
+        return policy;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->pec.position_policy, policy);
+    return count;
+}
+
+/**
+ * Reads PEC failure counters
+ */
+static ssize_t read_pec_errors(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_pec *pec = &to_motorknob(kobj)->pec;
+
+    return sysfs_emit(buffer, "transactions=%lld read_errors=%lld write_errors=%lld\n",
+                      atomic64_read(&pec->transactions), atomic64_read(&pec->read_errors),
+                      atomic64_read(&pec->write_errors));
+}
+
+/**
+ * Any write resets the PEC counters
+ */
+static ssize_t write_pec_errors(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_pec *pec = &to_motorknob(kobj)->pec;
+
+    atomic64_set(&pec->transactions, 0);
+    atomic64_set(&pec->read_errors, 0);
+    atomic64_set(&pec->write_errors, 0);
+    return count;
+}
+
+/**
+ * Reads the scrub interval in ms, 0 is off
+ */
+static ssize_t read_scrub_interval(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%u\n", READ_ONCE(to_motorknob(kobj)->scrub.interval_ms));
+}
+
+/**
+ * Writes a new scrub interval in ms and scrubs right away, 0 stops scrubbing
+ */
+static ssize_t write_scrub_interval(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_scrub *scrub = &to_motorknob(kobj)->scrub;
+    unsigned int interval_ms;
+    int ret = kstrtouint(buffer, 0, &interval_ms);
+
+    if (ret) {
+        return ret;
+    }
+
+    WRITE_ONCE(scrub->interval_ms, interval_ms);
+    if (interval_ms) {
+        mod_delayed_work(system_unbound_wq, &scrub->work, 0);
+    }
+
+    return count;
+}
+
+/**
+ * Reads the bus time budget in us per second, 0 is unlimited
+ */
+static ssize_t read_scrub_budget(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%u\n", READ_ONCE(to_motorknob(kobj)->scrub.budget_us));
+}
+
+static ssize_t write_scrub_budget(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    unsigned int budget_us;
+    int ret = kstrtouint(buffer, 0, &budget_us);
+
+    if (ret) {
+        return ret;
+    }
+    if (budget_us > USEC_PER_SEC) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->scrub.budget_us, budget_us);
+    return count;
+}
+
+/**
+ * Reads scrub counters
+ */
+static ssize_t read_scrub_stats(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_scrub *scrub = &to_motorknob(kobj)->scrub;
+
+    return sysfs_emit(buffer, "runs=%llu mismatches=%llu repairs=%llu errors=%llu last_bus_us=%llu\n",
+                      READ_ONCE(scrub->runs), READ_ONCE(scrub->mismatches), READ_ONCE(scrub->repairs),
+                      READ_ONCE(scrub->errors), READ_ONCE(scrub->last_bus_us));
+}
+
+/**
+ * Reads how long the first queued request waits for others, in us
+ */
+static ssize_t read_queue_window(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    return sysfs_emit(buffer, "%u\n", READ_ONCE(to_motorknob(kobj)->queue.window_us));
+}
+
+/**
+ * Writes the merge window in us, 0 only merges what queued up while the bus was busy
+ */
+static ssize_t write_queue_window(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    unsigned int window_us;
+    int ret = kstrtouint(buffer, 0, &window_us);
+
+    if (ret) {
+        return ret;
+    }
+    if (window_us > QUEUE_WINDOW_MAX) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(to_motorknob(kobj)->queue.window_us, window_us);
+    return count;
+}
+
+/**
+ * Reads the Knob this one drives
+ */
+static ssize_t read_link_target(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob *target;
+    int index = -1;
+
+    rcu_read_lock();
+    target = rcu_dereference(to_motorknob(kobj)->link.target);
+    if (target) {
+        index = target->index;
+    }
+    rcu_read_unlock();
+
+    if (index < 0) {
+        return sysfs_emit(buffer, "none\n");
+    }
+    return sysfs_emit(buffer, "%d\n", index);
+}
+
+/**
+ * Links this Knob to knobN, "none" unlinks, fails with ELOOP if knobN leads back here
+ * The target needs control/enabled and a spring_stiffness to follow
+ */
+static ssize_t write_link_target(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob *target = NULL, *old, *other;
+    int index;
+    int ret;
+
+    if (!sysfs_streq(buffer, "none")) {
+        ret = kstrtoint(buffer, 0, &index);
+        if (ret) {
+            return ret;
+        }
+        if (index == mk->index) {
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&motorknob_devices_lock);
+    if (!sysfs_streq(buffer, "none")) {
+        list_for_each_entry(other, &motorknob_devices, node) {
+            if (other->index == index) {
+                target = other;
+                kobject_get(&target->kobj);
+                break;
+            }
+        }
+        if (!target) {
+            mutex_unlock(&motorknob_devices_lock);
+            return -ENODEV;
+        }
+        // a loop would have the Knobs kick each other's bus threads forever
+        for (other = target; other;
+             other = rcu_dereference_protected(other->link.target, lockdep_is_held(&motorknob_devices_lock))) {
+            if (other == mk) {
+                mutex_unlock(&motorknob_devices_lock);
+                kobject_put(&target->kobj);
+                return -ELOOP;
+            }
+        }
+    }
+
+    old = rcu_replace_pointer(mk->link.target, target, lockdep_is_held(&motorknob_devices_lock));
+    mutex_unlock(&motorknob_devices_lock);
+
+    if (old) {
+        synchronize_rcu();
+        kobject_put(&old->kobj);
+    }
+
+    return count;
+}
+
+/**
+ * Reads the setpoint latency of this Knob as a link target
+ */
+static ssize_t read_link_latency(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_link *link = &to_motorknob(kobj)->link;
+    u64 count, sum, max;
+
+    spin_lock(&link->stats_lock);
+    count = link->latency_count;
+    sum = link->latency_sum;
+    max = link->latency_max;
+    spin_unlock(&link->stats_lock);
+
+    return sysfs_emit(buffer, "samples=%llu mean=%llu max=%llu\n", count, count ? div64_u64(sum, count) : 0, max);
+}
+
+/**
+ * Any write resets the latency statistics
+ */
+static ssize_t write_link_latency(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_link *link = &to_motorknob(kobj)->link;
+
+    spin_lock(&link->stats_lock);
+    link->latency_count = 0;
+    link->latency_sum = 0;
+    link->latency_max = 0;
+    spin_unlock(&link->stats_lock);
+
+    return count;
+}
+
+// integer parameters of the link
+#define LINK_ATTR(_name, _min, _max)                                                                 \
+static ssize_t read_link_##_name(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) { \
+    return sysfs_emit(buffer, "%d\n", READ_ONCE(to_motorknob(kobj)->link._name));                   \
+}                                                                                                    \
+static ssize_t write_link_##_name(struct kobject *kobj, struct kobj_attribute *attr,                \
+                                  const char *buffer, size_t count) {                                \
+    int value;                                                                                       \
+    int ret = kstrtoint(buffer, 0, &value);                                                          \
+    if (ret) {                                                                                       \
+        return ret;                                                                                  \
+    }                                                                                                \
+    if (value < (_min) || value > (_max)) {                                                          \
+        return -EINVAL;                                                                              \
+    }                                                                                                \
+    WRITE_ONCE(to_motorknob(kobj)->link._name, value);                                               \
+    return count;                                                                                    \
+}                                                                                                    \
+static struct kobj_attribute link_##_name##_attr = __ATTR(_name, 0660, read_link_##_name, write_link_##_name)
+
+LINK_ATTR(ratio, -LINK_RATIO_MAX, LINK_RATIO_MAX);
+LINK_ATTR(offset, -LINK_OFFSET_MAX, LINK_OFFSET_MAX);
+
+/*
+ * Virtual knobs
+ */
+
+/**
+ * Writes the profile of a virtual knob shifted into the Knob's positions
+ * Caller holds mk->lock
+ */
+static int motorknob_virtual_apply(struct motorknob *mk, const struct motorknob_vknob *vk, u16 offset) {
+    u16 values[PROFILE_REGISTERS] = {
+        [DATA_START_POS] = vk->start - offset,
+        [DATA_END_POS] = vk->end - offset,
+        [DATA_DETENTS] = vk->detents,
+    };
+
+    return motorknob_write_profile(mk, values);
+}
+
+/**
+ * Reads the profile on the Knob together with its position, one batch
+ */
+static int motorknob_virtual_read(struct motorknob *mk, u16 *profile, s32 *position) {
+    struct motorknob_request reqs[DATA_CURRENT_POS + 1];
+    int i;
+
+    for (i = 0; i <= DATA_CURRENT_POS; i++) {
+        reqs[i] = (struct motorknob_request) { .reg = i };
+    }
+    motorknob_submit(mk, reqs, ARRAY_SIZE(reqs));
+
+    for (i = 0; i <= DATA_CURRENT_POS; i++) {
+        if (reqs[i].result < 0) {
+            return reqs[i].result;
+        }
+    }
+    for (i = 0; i < PROFILE_REGISTERS; i++) {
+        profile[i] = reqs[i].word;
+    }
+    *position = reqs[DATA_CURRENT_POS].word;
+    return 0;
+}
+
+/**
+ * Makes a virtual knob the active one, -1 goes back to the Knob's own positions
+ * Remembers where the old one was left and continues the new one from there.
+ * The Knob's own profile is kept when the first one becomes active and written back on -1.
+ * Caller holds mk->lock
+ */
+static int motorknob_virtual_switch(struct motorknob *mk, int index) {
+    struct motorknob_virtual *virt = &mk->virt;
+    u16 own[PROFILE_REGISTERS];
+    s32 position;
+    u16 offset = 0;
+    int ret;
+
+    if (virt->active < 0 && index >= 0) {
+        ret = motorknob_virtual_read(mk, own, &position);
+    } else {
+        position = motorknob_read_word(mk, DATA_CURRENT_POS);
+        ret = position < 0 ? position : 0;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (index >= 0) {
+        offset = virt->knobs[index].position - position;
+        ret = motorknob_virtual_apply(mk, &virt->knobs[index], offset);
+    } else if (virt->active >= 0) {
+        ret = motorknob_write_profile(mk, virt->own);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (virt->active >= 0) {
+        virt->knobs[virt->active].position = position + virt->offset;
+    } else if (index >= 0) {
+        memcpy(virt->own, own, sizeof(virt->own));
+    }
+
+    WRITE_ONCE(virt->offset, offset);
+    WRITE_ONCE(virt->active, index);
+    return 0;
+}
+
+/**
+ * Reads the active virtual knob
+ */
+static ssize_t read_virtual_active(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    int active = READ_ONCE(to_motorknob(kobj)->virt.active);
+
+    if (active < 0) {
+        return sysfs_emit(buffer, "none\n");
+    }
+    return sysfs_emit(buffer, "%d\n", active);
+}
+
+/**
+ * Switches to another virtual knob, its profile and position in one go
+ */
+static ssize_t write_virtual_active(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    int index = -1;
+    int ret = 0;
+
+    if (!sysfs_streq(buffer, "none")) {
+        ret = kstrtoint(buffer, 0, &index);
+        if (ret) {
+            return ret;
+        }
+        if (index < 0 || index >= VIRTUAL_KNOBS) {
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&mk->lock);
+    if (index >= 0 && !mk->virt.knobs[index].valid) {
+        ret = -ENODATA;
+    } else {
+        ret = motorknob_virtual_switch(mk, index);
+    }
+    mutex_unlock(&mk->lock);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    sysfs_notify(&mk->kobj, "virtual", "active");
+    return count;
+}
+
+/**
+ * Reads the position of the active virtual knob
+ */
+static ssize_t read_virtual_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_sample sample;
+
+    motorknob_latest_sample(mk, &sample);
+    if (READ_ONCE(mk->virt.active) < 0 || !(sample.flags & MOTORKNOB_SAMPLE_VALID)) {
+        return -ENODATA;
+    }
+
+    return sysfs_emit(buffer, "%u\n", (u16) (sample.position + READ_ONCE(mk->virt.offset)));
+}
+
+/**
+ * Lists the virtual knobs, one line each: index start end detents position
+ */
+static ssize_t read_virtual_knobs(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_virtual *virt = &mk->virt;
+    struct motorknob_sample sample;
+    int len = 0;
+    int i;
+
+    motorknob_latest_sample(mk, &sample);
+
+    mutex_lock(&mk->lock);
+    for (i = 0; i < VIRTUAL_KNOBS; i++) {
+        const struct motorknob_vknob *vk = &virt->knobs[i];
+        u16 position = vk->position;
+
+        if (!vk->valid) {
+            continue;
+        }
+        if (i == virt->active) {
+            position = sample.position + virt->offset;
+        }
+        len += sysfs_emit_at(buffer, len, "%d %u %u %u %u\n", i, vk->start, vk->end, vk->detents, position);
+    }
+    mutex_unlock(&mk->lock);
+
+    return len;
+}
+
+/**
+ * Sets up a virtual knob: "index start end detents [position]"
+ * position defaults to start and is ignored for the active one, which gets its new profile right away
+ * "index" alone removes an inactive one
+ */
+static ssize_t write_virtual_knobs(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_virtual *virt = &mk->virt;
+    struct motorknob_vknob vk = { .valid = true };
+    int index;
+    int ret = 0;
+    int n;
+
+    n = sscanf(buffer, "%d %hu %hu %hu %hu", &index, &vk.start, &vk.end, &vk.detents, &vk.position);
+    if ((n != 1 && n < 4) || index < 0 || index >= VIRTUAL_KNOBS) {
+        return -EINVAL;
+    }
+    if (n == 4) {
+        vk.position = vk.start;
+    }
+
+    mutex_lock(&mk->lock);
+    if (index == virt->active) {
+        if (n == 1) {
+            ret = -EBUSY;
+        } else {
+            ret = motorknob_virtual_apply(mk, &vk, virt->offset);
+        }
+    }
+    if (!ret) {
+        virt->knobs[index] = n == 1 ? (struct motorknob_vknob) {} : vk;
+    }
+    mutex_unlock(&mk->lock);
+
+    return ret < 0 ? ret : count;
+}
+
+/*
+ * State
+ * knobN/state is everything userspace configured, as one blob. Saved before
+ * the module is unloaded and written back after it was loaded again, a reload
+ * does not lose anything. Restoring reads the Knob once and only writes the
+ * profile if the Knob lost it, the firmware usually kept it over the reload.
+ */
+#define STATE_MAGIC   0x4d4b5354 // "MKST"
+#define STATE_VERSION 2
+
+// fixed layout without implicit padding, reserved fields are 0
+struct motorknob_state_vknob {
+    u8 valid;
+    u8 reserved;
+    u16 start;
+    u16 end;
+    u16 detents;
+    u16 position;
+};
+
+struct motorknob_state {
+    u32 magic;
+    u16 version;
+    u16 size;
+    // the Knob it belongs to, indices may change over a reload
+    u32 adapter;
+    u16 addr;
+    u16 reserved0;
+
+    u16 profile[PROFILE_REGISTERS];
+    u8 profile_valid;
+    u8 relative;
+    u16 position; // when it was saved
+    u16 virt_offset;
+    s32 virt_active;
+    s64 accumulated;
+
+    s32 wall_stiffness;
+    s32 friction;
+    s32 spring_stiffness;
+    s32 spring_center;
+    s32 torque_limit;
+    s32 link_ratio;
+    s32 link_offset;
+
+    u16 virt_own[PROFILE_REGISTERS];
+    u16 reserved1;
+    struct motorknob_state_vknob virt[VIRTUAL_KNOBS];
+
+    u32 crc; // crc32 of everything before
+};
+static_assert(sizeof(struct motorknob_state) == 160);
+
+/**
+ * Collects the current state
+ * Caller holds mk->lock
+ */
+static void motorknob_state_save(struct motorknob *mk, struct motorknob_state *state) {
+    const struct motorknob_profile *profile;
+    struct motorknob_sample sample;
+    int i;
+
+    // goes to userspace, reserved fields included
+    memset(state, 0, sizeof(*state));
+    state->magic = STATE_MAGIC;
+    state->version = STATE_VERSION;
+    state->size = sizeof(*state);
+    state->adapter = mk->client->adapter->nr;
+    state->addr = mk->client->addr;
+    state->relative = mk->relative;
+    state->wall_stiffness = mk->control.wall_stiffness;
+    state->friction = mk->control.friction;
+    state->spring_stiffness = mk->control.spring_stiffness;
+    state->spring_center = mk->control.spring_center;
+    state->torque_limit = mk->control.torque_limit;
+    state->link_ratio = mk->link.ratio;
+    state->link_offset = mk->link.offset;
+    state->virt_active = mk->virt.active;
+    state->virt_offset = mk->virt.offset;
+    memcpy(state->virt_own, mk->virt.own, sizeof(state->virt_own));
+
+    rcu_read_lock();
+    profile = rcu_dereference(mk->profile);
+    memcpy(state->profile, profile->values, sizeof(state->profile));
+    state->profile_valid = profile->valid;
+    rcu_read_unlock();
+
+    // accumulated counts up to the base, not to whatever was published last
+    mutex_lock(&mk->sample_mutex);
+    motorknob_latest_sample(mk, &sample);
+    state->position = mk->sampler.base_valid ? mk->sampler.base : sample.position;
+    state->accumulated = mk->accumulated;
+    mutex_unlock(&mk->sample_mutex);
+
+    for (i = 0; i < VIRTUAL_KNOBS; i++) {
+        const struct motorknob_vknob *vk = &mk->virt.knobs[i];
+
+        state->virt[i].valid = vk->valid;
+        state->virt[i].start = vk->start;
+        state->virt[i].end = vk->end;
+        state->virt[i].detents = vk->detents;
+        state->virt[i].position = vk->position;
+    }
+    state->crc = crc32(0, state, offsetof(struct motorknob_state, crc));
+}
+
+/**
+ * Takes a saved state back
+ * One read of profile and position (one block transfer if the Knob can),
+ * the profile is only written if the Knob does not have it anymore.
+ * Motion while the driver was away is added to accumulated.
+ * Caller holds mk->lock
+ */
+static int motorknob_state_restore(struct motorknob *mk, const struct motorknob_state *state) {
+    struct motorknob_request reqs[DATA_CURRENT_POS + 1];
+    struct motorknob_request writes[PROFILE_REGISTERS];
+    unsigned long valid = state->profile_valid;
+    unsigned int reg;
+    bool lost = false;
+    s32 base;
+    int count = 0;
+    int i;
+
+    if (state->magic != STATE_MAGIC || state->version != STATE_VERSION || state->size != sizeof(*state) ||
+        state->crc != crc32(0, state, offsetof(struct motorknob_state, crc))) {
+        return -EINVAL;
+    }
+    if (state->adapter != mk->client->adapter->nr || state->addr != mk->client->addr) {
+        return -ENODEV;
+    }
+    if (state->reserved0 || state->reserved1 || state->profile_valid > GENMASK(PROFILE_REGISTERS - 1, 0) ||
+        state->relative > 1 || (state->relative && !(mk->caps & CAP_DELTA))) {
+        return -EINVAL;
+    }
+    // a good checksum does not make the values sane, same bounds as sysfs
+    if (state->wall_stiffness < 0 || state->wall_stiffness > CONTROL_STIFFNESS_MAX ||
+        state->friction < 0 || state->friction > CONTROL_FRICTION_MAX ||
+        state->spring_stiffness < 0 || state->spring_stiffness > CONTROL_STIFFNESS_MAX ||
+        state->spring_center < 0 || state->spring_center > CONTROL_CENTER_MAX ||
+        state->torque_limit < 0 || state->torque_limit > CONTROL_TORQUE_MAX ||
+        state->link_ratio < -LINK_RATIO_MAX || state->link_ratio > LINK_RATIO_MAX ||
+        state->link_offset < -LINK_OFFSET_MAX || state->link_offset > LINK_OFFSET_MAX) {
+        return -EINVAL;
+    }
+    for (i = 0; i < VIRTUAL_KNOBS; i++) {
+        if (state->virt[i].valid > 1 || state->virt[i].reserved) {
+            return -EINVAL;
+        }
+    }
+    if (state->virt_active < -1 || state->virt_active >= VIRTUAL_KNOBS ||
+        (state->virt_active >= 0 && !state->virt[state->virt_active].valid)) {
+        return -EINVAL;
+    }
+
+    // profile and position in one batch, a single block transfer without PEC
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        reqs[i] = (struct motorknob_request) { .reg = i };
+    }
+    motorknob_submit(mk, reqs, ARRAY_SIZE(reqs));
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        if (reqs[i].result < 0) {
+            return reqs[i].result;
+        }
+    }
+
+    for_each_set_bit(reg, &valid, PROFILE_REGISTERS) {
+        lost |= reqs[reg].word != state->profile[reg];
+    }
+
+    if (lost) {
+        for_each_set_bit(reg, &valid, PROFILE_REGISTERS) {
+            writes[count++] = (struct motorknob_request) {
+                .reg = reg,
+                .write = true,
+                .word = state->profile[reg],
+            };
+        }
+
+        dev_info(&mk->client->dev, "Profile was lost, restoring it\n");
+        motorknob_submit(mk, writes, count);
+        for (i = 0; i < count; i++) {
+            if (writes[i].result < 0) {
+                return writes[i].result;
+            }
+        }
+    }
+
+    // accumulated has to match the base the sampler continues from
+    // a delta register would have counted the motion in between too, only rebasing clears it
+    mutex_lock(&mk->sample_mutex);
+    if (state->relative) {
+        base = motorknob_sampler_rebase(mk, true);
+    } else {
+        base = reqs[DATA_CURRENT_POS].word;
+        mk->sampler.base = base;
+        mk->sampler.base_valid = true;
+        WRITE_ONCE(mk->relative, false);
+    }
+    if (base >= 0) {
+        WRITE_ONCE(mk->accumulated, state->accumulated + (s16) (base - state->position));
+    }
+    mutex_unlock(&mk->sample_mutex);
+    if (base < 0) {
+        return base;
+    }
+
+    WRITE_ONCE(mk->control.wall_stiffness, state->wall_stiffness);
+    WRITE_ONCE(mk->control.friction, state->friction);
+    WRITE_ONCE(mk->control.spring_stiffness, state->spring_stiffness);
+    WRITE_ONCE(mk->control.spring_center, state->spring_center);
+    WRITE_ONCE(mk->control.torque_limit, state->torque_limit);
+    WRITE_ONCE(mk->link.ratio, state->link_ratio);
+    WRITE_ONCE(mk->link.offset, state->link_offset);
 
-// i2c
-static struct i2c_client *motorknob_client;
+    for (i = 0; i < VIRTUAL_KNOBS; i++) {
+        struct motorknob_vknob *vk = &mk->virt.knobs[i];
 
-/**
- * Writes a word (16bit) to MotorKnob
- * Uses first and second element in buffer
- */
-static ssize_t motorknob_write(u8 reg, const char *user_buffer, size_t count) {
-    // Check for valid data length
-    if (count < 2) {
-        return -EINVAL; // Invalid argument (too few bytes)
+        vk->valid = state->virt[i].valid;
+        vk->start = state->virt[i].start;
+        vk->end = state->virt[i].end;
+        vk->detents = state->virt[i].detents;
+        vk->position = state->virt[i].position;
     }
+    memcpy(mk->virt.own, state->virt_own, sizeof(mk->virt.own));
+    WRITE_ONCE(mk->virt.offset, state->virt_offset);
+    WRITE_ONCE(mk->virt.active, state->virt_active);
 
-    // build word
-    uint16_t word = ((uint16_t) user_buffer[0]) << 8;
-    word ^= user_buffer[1];
+    return 0;
+}
 
-    // use smbus protocol to transfer
-    s32 ret = i2c_smbus_write_word_data(motorknob_client, reg, word);
-    
-    if (ret < 0) {
-        pr_err("Failed to send data: %d\n", ret);
-        return ret;
-    }
+static ssize_t read_state(struct file *file, struct kobject *kobj, struct bin_attribute *attr,
+                          char *buffer, loff_t offset, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_state state;
 
-    return count; // Indicate successful write of all bytes
+    mutex_lock(&mk->lock);
+    motorknob_state_save(mk, &state);
+    mutex_unlock(&mk->lock);
+
+    return memory_read_from_buffer(buffer, count, &offset, &state, sizeof(state));
 }
 
 /**
- * Reads a word (16bit) from MotorKnob
- * buffer needs to be atleast two bytes big
+ * Restores a state read from knobN/state, it has to come in one write
  */
-static ssize_t motorknob_read(u8 reg, char *user_buffer) {
-    s32 result = i2c_smbus_read_word_data(motorknob_client, reg);
+static ssize_t write_state(struct file *file, struct kobject *kobj, struct bin_attribute *attr,
+                           char *buffer, loff_t offset, size_t count) {
+    struct motorknob *mk = to_motorknob(kobj);
+    struct motorknob_state state;
+    int ret;
 
-    if (result < 0) {
-	    pr_err("Failed to read byte");
-    	return result;
+    if (offset != 0 || count != sizeof(state)) {
+        return -EINVAL;
     }
+    memcpy(&state, buffer, sizeof(state));
 
-    user_buffer[0] = (u8) result;
-    user_buffer[1] = (u8) (result >> 8);
+    mutex_lock(&mk->lock);
+    ret = motorknob_state_restore(mk, &state);
+    mutex_unlock(&mk->lock);
 
-    return 2;
+    return ret < 0 ? ret : count;
 }
 
 /**
- * Reads number of detents from Knob
+ * Reads the latest position of every Knob as text
+ * one line per Knob: index position timestamp_ns
  */
-static ssize_t read_detents(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
-    return motorknob_read(DATA_DETENTS, buffer);
-}
+static ssize_t read_snapshot(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob *mk;
+    struct motorknob_sample sample;
+    int len = 0;
 
-/**
- * Writes number of detents
- */
-static ssize_t write_detents(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
-    return motorknob_write(WRITE_DETENTS, buffer, count);
+    mutex_lock(&motorknob_devices_lock);
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        motorknob_latest_sample(mk, &sample);
+        if (!(sample.flags & MOTORKNOB_SAMPLE_VALID)) {
+            continue;
+        }
+        len += sysfs_emit_at(buffer, len, "%u %u %llu\n", sample.index, sample.position, sample.timestamp_ns);
+    }
+    mutex_unlock(&motorknob_devices_lock);
+
+    return len;
 }
 
-/**
- * Reads start position from Knob
- */
-static ssize_t read_start_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
-    return motorknob_read(DATA_START_POS, buffer);
+// sysfs files
+static struct kobj_attribute detent_attr = __ATTR(detents, 0660, read_detents, write_detents);
+static struct kobj_attribute start_pos_attr = __ATTR(start_position, 0660, read_start_position, write_start_position);
+static struct kobj_attribute end_pos_attr = __ATTR(end_position, 0660, read_end_position, write_end_position);
+static struct kobj_attribute position_attr = __ATTR(position, 0440, read_position, NULL); // only read
+static struct kobj_attribute max_age_attr = __ATTR(max_age_us, 0660, read_max_age, write_max_age);
+
+static struct kobj_attribute mode_attr = __ATTR(mode, 0660, read_mode, write_mode);
+static struct kobj_attribute accumulated_attr = __ATTR(accumulated, 0440, read_accumulated, NULL);
+static struct kobj_attribute age_attr = __ATTR(age_ns, 0440, read_age, NULL);
+
+static struct kobj_attribute snapshot_attr = __ATTR(snapshot, 0440, read_snapshot, NULL);
+
+static struct attribute *knob_attrs[] = {
+    &position_attr.attr,
+    &max_age_attr.attr,
+    &mode_attr.attr,
+    &accumulated_attr.attr,
+    &age_attr.attr,
+    NULL,
+};
+
+static struct bin_attribute state_attr = __BIN_ATTR(state, 0600, read_state, write_state, sizeof(struct motorknob_state));
+
+static struct bin_attribute *knob_bin_attrs[] = {
+    &state_attr,
+    NULL,
+};
+
+static const struct attribute_group knob_group = {
+    .attrs = knob_attrs,
+    .bin_attrs = knob_bin_attrs,
+};
+
+static struct attribute *profile_attrs[] = {
+    &detent_attr.attr,
+    &start_pos_attr.attr,
+    &end_pos_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group profile_group = {
+    .name = "profile",
+    .attrs = profile_attrs,
+};
+
+static struct kobj_attribute sample_enabled_attr = __ATTR(enabled, 0660, read_sample_enabled, write_sample_enabled);
+static struct kobj_attribute sample_rate_attr = __ATTR(rate, 0660, read_sample_rate, write_sample_rate);
+static struct kobj_attribute sample_jitter_attr = __ATTR(jitter, 0660, read_sample_jitter, write_sample_jitter);
+static struct kobj_attribute sample_latency_attr = __ATTR(latency, 0660, read_sample_latency, write_sample_latency);
+static struct kobj_attribute sample_triggered_attr = __ATTR(triggered, 0660, read_sample_triggered, write_sample_triggered);
+static struct kobj_attribute sample_bus_attr = __ATTR(bus, 0440, read_sample_bus, NULL);
+static struct kobj_attribute sample_trigger_offset_attr = __ATTR(trigger_offset_us, 0660, read_trigger_offset, write_trigger_offset);
+
+static struct attribute *sampler_attrs[] = {
+    &sample_enabled_attr.attr,
+    &sample_rate_attr.attr,
+    &sample_jitter_attr.attr,
+    &sample_latency_attr.attr,
+    &sample_triggered_attr.attr,
+    &sample_bus_attr.attr,
+    &sample_trigger_offset_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group sampler_group = {
+    .name = "sampler",
+    .attrs = sampler_attrs,
+};
+
+static struct kobj_attribute pec_available_attr = __ATTR(available, 0440, read_pec_available, NULL);
+static struct kobj_attribute pec_position_attr = __ATTR(position, 0660, read_pec_position, write_pec_position);
+static struct kobj_attribute pec_errors_attr = __ATTR(errors, 0660, read_pec_errors, write_pec_errors);
+
+static struct attribute *pec_attrs[] = {
+    &pec_available_attr.attr,
+    &pec_position_attr.attr,
+    &pec_errors_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group pec_group = {
+    .name = "pec",
+    .attrs = pec_attrs,
+};
+
+static struct kobj_attribute scrub_interval_attr = __ATTR(interval_ms, 0660, read_scrub_interval, write_scrub_interval);
+static struct kobj_attribute scrub_budget_attr = __ATTR(budget_us, 0660, read_scrub_budget, write_scrub_budget);
+static struct kobj_attribute scrub_stats_attr = __ATTR(stats, 0440, read_scrub_stats, NULL);
+
+static struct attribute *scrub_attrs[] = {
+    &scrub_interval_attr.attr,
+    &scrub_budget_attr.attr,
+    &scrub_stats_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group scrub_group = {
+    .name = "scrub",
+    .attrs = scrub_attrs,
+};
+
+static struct kobj_attribute queue_window_attr = __ATTR(window_us, 0660, read_queue_window, write_queue_window);
+
+static struct attribute *queue_attrs[] = {
+    &queue_window_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group queue_group = {
+    .name = "queue",
+    .attrs = queue_attrs,
+};
+
+static struct kobj_attribute control_enabled_attr = __ATTR(enabled, 0660, read_control_enabled, write_control_enabled);
+
+static struct attribute *control_attrs[] = {
+    &control_enabled_attr.attr,
+    &control_wall_stiffness_attr.attr,
+    &control_friction_attr.attr,
+    &control_spring_stiffness_attr.attr,
+    &control_spring_center_attr.attr,
+    &control_torque_limit_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group control_group = {
+    .name = "control",
+    .attrs = control_attrs,
+};
+
+static struct kobj_attribute link_target_attr = __ATTR(target, 0660, read_link_target, write_link_target);
+static struct kobj_attribute link_latency_attr = __ATTR(latency, 0660, read_link_latency, write_link_latency);
+
+static struct attribute *link_attrs[] = {
+    &link_target_attr.attr,
+    &link_ratio_attr.attr,
+    &link_offset_attr.attr,
+    &link_latency_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group link_group = {
+    .name = "link",
+    .attrs = link_attrs,
+};
+
+static struct kobj_attribute virtual_active_attr = __ATTR(active, 0660, read_virtual_active, write_virtual_active);
+static struct kobj_attribute virtual_position_attr = __ATTR(position, 0440, read_virtual_position, NULL);
+static struct kobj_attribute virtual_knobs_attr = __ATTR(knobs, 0660, read_virtual_knobs, write_virtual_knobs);
+
+static struct attribute *virtual_attrs[] = {
+    &virtual_active_attr.attr,
+    &virtual_position_attr.attr,
+    &virtual_knobs_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group virtual_group = {
+    .name = "virtual",
+    .attrs = virtual_attrs,
+};
+
+// everything in /sys/motorknob/knobN, created and removed together with the kobject
+static const struct attribute_group *motorknob_groups[] = {
+    &knob_group,
+    &profile_group,
+    &sampler_group,
+    &pec_group,
+    &control_group,
+    &scrub_group,
+    &queue_group,
+    &link_group,
+    &virtual_group,
+    NULL,
+};
+
+static void motorknob_release(struct kobject *kobj) {
+    struct motorknob *mk = to_motorknob(kobj);
+
+    ida_free(&motorknob_ida, mk->index);
+    kfree(rcu_access_pointer(mk->profile));
+    kvfree(mk->history);
+    kfree(mk);
 }
 
-/**
- * Writes new start position
+static const struct kobj_type motorknob_ktype = {
+    .release = motorknob_release,
+    .sysfs_ops = &kobj_sysfs_ops,
+};
+
+/*
+ * Legacy sysfs
+ * Before several Knobs were supported their files sat right in /sys/motorknob.
+ * These forward to knob0 so existing readers keep working, new code should use knobN.
  */
-static ssize_t write_start_position(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
-    return motorknob_write(WRITE_START_POS, buffer, count);
+struct motorknob_legacy_attr {
+    struct kobj_attribute attr;
+    struct kobj_attribute *knob_attr;
+};
+
+#define LEGACY_ATTR(_var, _name, _mode, _target) \
+static struct motorknob_legacy_attr legacy_##_var##_attr = { \
+    .attr = __ATTR(_name, _mode, read_legacy, write_legacy), \
+    .knob_attr = &(_target), \
 }
 
 /**
- * Reads end position from Knob
+ * Finds knob0, ENODEV without it
+ * Caller holds motorknob_devices_lock, remove takes it before tearing anything down
  */
-static ssize_t read_end_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
-    return motorknob_read(DATA_END_POS, buffer);
+static struct motorknob *motorknob_legacy_knob(void) {
+    struct motorknob *mk;
+
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        if (mk->index == 0) {
+            return mk;
+        }
+    }
+    return NULL;
 }
 
-/**
- * Writes new end position
- */
-static ssize_t write_end_position(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
-    return motorknob_write(WRITE_END_POS, buffer, count);
+static ssize_t read_legacy(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
+    struct motorknob_legacy_attr *legacy = container_of(attr, struct motorknob_legacy_attr, attr);
+    struct motorknob *mk;
+    ssize_t ret = -ENODEV;
+
+    mutex_lock(&motorknob_devices_lock);
+    mk = motorknob_legacy_knob();
+    if (mk) {
+        ret = legacy->knob_attr->show(&mk->kobj, legacy->knob_attr, buffer);
+    }
+    mutex_unlock(&motorknob_devices_lock);
+    return ret;
 }
 
-/**
- * Reads position from Knob
- */
-static ssize_t read_position(struct kobject *kobj, struct kobj_attribute *attr, char *buffer) {
-    return motorknob_read(DATA_CURRENT_POS, buffer);
+static ssize_t write_legacy(struct kobject *kobj, struct kobj_attribute *attr, const char *buffer, size_t count) {
+    struct motorknob_legacy_attr *legacy = container_of(attr, struct motorknob_legacy_attr, attr);
+    struct motorknob *mk;
+    ssize_t ret = -ENODEV;
+
+    if (!legacy->knob_attr->store) {
+        return -EIO;
+    }
+
+    mutex_lock(&motorknob_devices_lock);
+    mk = motorknob_legacy_knob();
+    if (mk) {
+        ret = legacy->knob_attr->store(&mk->kobj, legacy->knob_attr, buffer, count);
+    }
+    mutex_unlock(&motorknob_devices_lock);
+    return ret;
 }
 
-// sysfs files
-static struct kobj_attribute detent_attr = __ATTR(detents, 0660, read_detents, write_detents);
-static struct kobj_attribute start_pos_attr = __ATTR(start_position, 0660, read_start_position, write_start_position);
-static struct kobj_attribute end_pos_attr = __ATTR(end_position, 0660, read_end_position, write_end_position);
-static struct kobj_attribute position_attr = __ATTR(position, 0440, read_position, NULL); // only read
+LEGACY_ATTR(position, position, 0440, position_attr);
+LEGACY_ATTR(detents, detents, 0660, detent_attr);
+LEGACY_ATTR(start_pos, start_position, 0660, start_pos_attr);
+LEGACY_ATTR(end_pos, end_position, 0660, end_pos_attr);
+LEGACY_ATTR(sample_rate, rate, 0660, sample_rate_attr);
+LEGACY_ATTR(sample_jitter, jitter, 0660, sample_jitter_attr);
+LEGACY_ATTR(pec_available, available, 0440, pec_available_attr);
+LEGACY_ATTR(pec_position, position, 0660, pec_position_attr);
+LEGACY_ATTR(pec_errors, errors, 0660, pec_errors_attr);
+LEGACY_ATTR(control_enabled, enabled, 0660, control_enabled_attr);
+LEGACY_ATTR(control_wall_stiffness, wall_stiffness, 0660, control_wall_stiffness_attr);
+LEGACY_ATTR(control_friction, friction, 0660, control_friction_attr);
+LEGACY_ATTR(control_spring_stiffness, spring_stiffness, 0660, control_spring_stiffness_attr);
+LEGACY_ATTR(control_spring_center, spring_center, 0660, control_spring_center_attr);
+LEGACY_ATTR(control_torque_limit, torque_limit, 0660, control_torque_limit_attr);
+
+static struct attribute *legacy_attrs[] = {
+    &legacy_position_attr.attr.attr,
+    NULL,
+};
+
+static struct attribute *legacy_profile_attrs[] = {
+    &legacy_detents_attr.attr.attr,
+    &legacy_start_pos_attr.attr.attr,
+    &legacy_end_pos_attr.attr.attr,
+    NULL,
+};
+
+static struct attribute *legacy_sampler_attrs[] = {
+    &legacy_sample_rate_attr.attr.attr,
+    &legacy_sample_jitter_attr.attr.attr,
+    NULL,
+};
+
+static struct attribute *legacy_pec_attrs[] = {
+    &legacy_pec_available_attr.attr.attr,
+    &legacy_pec_position_attr.attr.attr,
+    &legacy_pec_errors_attr.attr.attr,
+    NULL,
+};
+
+static struct attribute *legacy_control_attrs[] = {
+    &legacy_control_enabled_attr.attr.attr,
+    &legacy_control_wall_stiffness_attr.attr.attr,
+    &legacy_control_friction_attr.attr.attr,
+    &legacy_control_spring_stiffness_attr.attr.attr,
+    &legacy_control_spring_center_attr.attr.attr,
+    &legacy_control_torque_limit_attr.attr.attr,
+    NULL,
+};
+
+static const struct attribute_group legacy_group = { .attrs = legacy_attrs };
+static const struct attribute_group legacy_profile_group = { .name = "profile", .attrs = legacy_profile_attrs };
+static const struct attribute_group legacy_sampler_group = { .name = "sampler", .attrs = legacy_sampler_attrs };
+static const struct attribute_group legacy_pec_group = { .name = "pec", .attrs = legacy_pec_attrs };
+static const struct attribute_group legacy_control_group = { .name = "control", .attrs = legacy_control_attrs };
+
+static const struct attribute_group *legacy_groups[] = {
+    &legacy_group,
+    &legacy_profile_group,
+    &legacy_sampler_group,
+    &legacy_pec_group,
+    &legacy_control_group,
+    NULL,
+};
 
 /**
- * Creates sysfs entries including error handling
+ * Creates /sys/motorknob with the files not belonging to a single Knob
  */
-int setup_sysfs(void) {
-    // there is probably a cooler way to set this up
-    // error handling gets quite cumbersome
-
-    motorknob_kobj = kobject_create_and_add("motorknob", NULL);
-    if(!motorknob_kobj) {
+static int setup_sysfs(void) {
+    motorknob_kset = kset_create_and_add("motorknob", NULL, NULL);
+    if(!motorknob_kset) {
 	    printk("motorknob-sysfs - Error creating /sys/motorknob\n");
 	    return -ENOMEM;
     }
-    
-    motorknob_profile_kobj = kobject_create_and_add("profile", motorknob_kobj);
-    if(!motorknob_profile_kobj) {
-	    printk("motorknob-sysfs - Error creating /sys/motorknob/profile\n");
-	    kobject_put(motorknob_kobj);
-	    return -ENOMEM;
-    }
+    motorknob_kobj = &motorknob_kset->kobj;
 
-    if(sysfs_create_file(motorknob_profile_kobj, &detent_attr.attr)) {
-	    printk("motorknob-sysfs - Error creating /sys/motorknob/profile/detents\n");
-	    kobject_put(motorknob_kobj);
-	    kobject_put(motorknob_profile_kobj);
-	    return -ENOMEM;
-    }
-    
-    if(sysfs_create_file(motorknob_profile_kobj, &start_pos_attr.attr)) {
-	    printk("motorknob-sysfs - Error creating /sys/motorknob/profile/start_position\n");
-	    sysfs_remove_file(motorknob_profile_kobj, &detent_attr.attr);
-	    kobject_put(motorknob_profile_kobj);
-	    kobject_put(motorknob_kobj);
-	    return -ENOMEM;
-    }
-    
-    if(sysfs_create_file(motorknob_profile_kobj, &end_pos_attr.attr)) {
-	    printk("motorknob-sysfs - Error creating /sys/motorknob/profile/end_position\n");
-	    sysfs_remove_file(motorknob_profile_kobj, &detent_attr.attr);
-	    sysfs_remove_file(motorknob_profile_kobj, &start_pos_attr.attr);
-	    kobject_put(motorknob_profile_kobj);
-	    kobject_put(motorknob_kobj);
+    if(sysfs_create_file(motorknob_kobj, &snapshot_attr.attr)) {
+	    printk("motorknob-sysfs - Error creating /sys/motorknob/snapshot\n");
+	    kset_unregister(motorknob_kset);
 	    return -ENOMEM;
     }
-    
-    if(sysfs_create_file(motorknob_kobj, &position_attr.attr)) {
-	    printk("motorknob-sysfs - Error creating /sys/motorknob/position\n");
-	    sysfs_remove_file(motorknob_profile_kobj, &detent_attr.attr);
-	    sysfs_remove_file(motorknob_profile_kobj, &start_pos_attr.attr);
-	    sysfs_remove_file(motorknob_profile_kobj, &end_pos_attr.attr);
-	    kobject_put(motorknob_profile_kobj);
-	    kobject_put(motorknob_kobj);
-	    return -ENOMEM;
+
+    if (sysfs_create_groups(motorknob_kobj, legacy_groups)) {
+        printk("motorknob-sysfs - Error creating the legacy files in /sys/motorknob\n");
+        sysfs_remove_file(motorknob_kobj, &snapshot_attr.attr);
+        kset_unregister(motorknob_kset);
+        return -ENOMEM;
     }
 
-	printk("motorknob-sysfs - Created /sys/motorknob/*\n");
+	printk("motorknob-sysfs - Created /sys/motorknob\n");
 
     return 0;
 }
@@ -190,15 +4683,11 @@ int setup_sysfs(void) {
 /**
  * Removes all sysfs entires
  */
-void destory_sysfs(void) {
+static void destory_sysfs(void) {
     printk("motorknob-sysfs - Deleting entries\n");
-    sysfs_remove_file(motorknob_profile_kobj, &detent_attr.attr);
-    sysfs_remove_file(motorknob_profile_kobj, &start_pos_attr.attr);
-    sysfs_remove_file(motorknob_profile_kobj, &end_pos_attr.attr);
-    sysfs_remove_file(motorknob_kobj, &position_attr.attr);
-    
-    kobject_put(motorknob_profile_kobj);
-    kobject_put(motorknob_kobj);
+    sysfs_remove_groups(motorknob_kobj, legacy_groups);
+    sysfs_remove_file(motorknob_kobj, &snapshot_attr.attr);
+    kset_unregister(motorknob_kset);
 }
 
 // replaced by sysfs
@@ -207,23 +4696,212 @@ void destory_sysfs(void) {
 // 	.proc_read = motorknob_read,
 // };
 
+/**
+ * Positions of all Knobs, see struct motorknob_snapshot
+ */
+static long motorknob_ioctl_snapshot(struct motorknob_snapshot __user *arg) {
+    struct motorknob_snapshot snapshot;
+    struct motorknob_sample *samples;
+    u32 count;
+    long ret = 0;
+
+    if (copy_from_user(&snapshot, arg, sizeof(snapshot))) {
+        return -EFAULT;
+    }
+    if (snapshot.flags & ~MOTORKNOB_SNAPSHOT_FRESH) {
+        return -EINVAL;
+    }
+
+    snapshot.count = min_t(u32, snapshot.count, SNAPSHOT_MAX);
+    samples = kcalloc(snapshot.count, sizeof(*samples), GFP_KERNEL);
+    if (snapshot.count && !samples) {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&motorknob_devices_lock);
+    if (snapshot.flags & MOTORKNOB_SNAPSHOT_FRESH) {
+        motorknob_snapshot_refresh();
+    }
+    count = motorknob_snapshot_fill(samples, snapshot.count);
+    mutex_unlock(&motorknob_devices_lock);
+
+    if (copy_to_user(u64_to_user_ptr(snapshot.samples), samples,
+                     min(count, snapshot.count) * sizeof(*samples))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    snapshot.count = count;
+    if (copy_to_user(arg, &snapshot, sizeof(snapshot))) {
+        ret = -EFAULT;
+    }
+
+out:
+    kfree(samples);
+    return ret;
+}
+
+/**
+ * Arms a fresh read on every Knob, each bus reads its Knobs in parallel to the others
+ */
+static long motorknob_ioctl_trigger_all(struct motorknob_trigger __user *arg) {
+    struct motorknob_trigger trigger;
+    struct motorknob *mk;
+    int ret = motorknob_trigger_get(arg, &trigger);
+
+    if (ret) {
+        return ret;
+    }
+
+    mutex_lock(&motorknob_devices_lock);
+    list_for_each_entry(mk, &motorknob_devices, node) {
+        motorknob_sampler_arm(mk, trigger.at_ns);
+    }
+    mutex_unlock(&motorknob_devices_lock);
+
+    return 0;
+}
+
+static long motorknob_ctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    switch (cmd) {
+    case MOTORKNOB_IOC_SNAPSHOT:
+        return motorknob_ioctl_snapshot((struct motorknob_snapshot __user *) arg);
+    case MOTORKNOB_IOC_TRIGGER_ALL:
+        return motorknob_ioctl_trigger_all((struct motorknob_trigger __user *) arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations motorknob_ctl_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = motorknob_ctl_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = noop_llseek,
+};
+
+// /dev/motorknob, for everything spanning all Knobs
+static struct miscdevice motorknob_ctl_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "motorknob",
+    .fops = &motorknob_ctl_fops,
+    .mode = 0444,
+};
+
 /**
  * Gets called when a new device gets attached to this driver
- * Just accepts it as the MotorKnob
+ * Every Knob gets its own /sys/motorknob/knobN
  */
 static int my_i2c_probe(struct i2c_client *client) {
-    motorknob_client = client;
+    struct motorknob *mk = kzalloc(sizeof(*mk), GFP_KERNEL);
+    int ret;
+
+    if (!mk) {
+        return -ENOMEM;
+    }
+
+    mk->index = ida_alloc(&motorknob_ida, GFP_KERNEL);
+    if (mk->index < 0) {
+        ret = mk->index;
+        kfree(mk);
+        return ret;
+    }
+
+    mk->history_mask = roundup_pow_of_two(clamp(history_size, 2U, 1U << 20)) - 1;
+    mk->history = kvcalloc(mk->history_mask + 1, sizeof(*mk->history), GFP_KERNEL);
+    if (!mk->history) {
+        ida_free(&motorknob_ida, mk->index);
+        kfree(mk);
+        return -ENOMEM;
+    }
+
+    // nothing known about the profile yet
+    RCU_INIT_POINTER(mk->profile, kzalloc(sizeof(struct motorknob_profile), GFP_KERNEL));
+    if (!rcu_access_pointer(mk->profile)) {
+        kvfree(mk->history);
+        ida_free(&motorknob_ida, mk->index);
+        kfree(mk);
+        return -ENOMEM;
+    }
+
+    mk->client = client;
+    mutex_init(&mk->lock);
+    mutex_init(&mk->profile_lock);
+    mutex_init(&mk->hid_lock);
+    mutex_init(&mk->sample_mutex);
+    mutex_init(&mk->position_lock);
+    init_rwsem(&mk->file_io);
+    seqlock_init(&mk->sample_lock);
+    INIT_WORK(&mk->snapshot_work, motorknob_snapshot_work);
+    init_waitqueue_head(&mk->history_wait);
+    spin_lock_init(&mk->zone_lock);
+    INIT_LIST_HEAD(&mk->zone_files);
+    INIT_LIST_HEAD(&mk->sequences);
+    setup_queue(mk);
+    mk->sample.index = mk->index;
+    mk->pec.position_policy = PEC_AUTO;
+    mk->control.torque_limit = S16_MAX;
+    mk->virt.active = -1;
+    mk->link.ratio = LINK_RATIO_ONE;
+    spin_lock_init(&mk->link.stats_lock);
+    i2c_set_clientdata(client, mk);
 
     // Perform any necessary client-specific initialization here
     // (e.g., configure registers, allocate resources)
 
-    dev_info(&client->dev, "I2C Motorknob client probed\n");
+    dev_info(&client->dev, "I2C Motorknob client probed as knob%d\n", mk->index);
+
+    motorknob_read_caps(mk);
+
+    // from here on the kobject owns mk
+    mk->kobj.kset = motorknob_kset;
+    ret = kobject_init_and_add(&mk->kobj, &motorknob_ktype, motorknob_kobj, "knob%d", mk->index);
+    if (ret) {
+        dev_err(&client->dev, "Error creating /sys/motorknob/knob%d\n", mk->index);
+        kobject_put(&mk->kobj);
+        return ret;
+    }
+
+    // lets userspace find hidraw and friends of this Knob
+    ret = sysfs_create_link(&mk->kobj, &client->dev.kobj, "device");
+    if (ret) {
+        kobject_put(&mk->kobj);
+        return ret;
+    }
+
+    ret = setup_sampler(mk);
+    if (ret < 0) {
+        kobject_put(&mk->kobj);
+        return ret;
+    }
+
+    // the Knob works fine without HID, just complain
+    ret = setup_hid(mk);
+    if (ret < 0) {
+        dev_warn(&client->dev, "Failed to register HID device: %d\n", ret);
+    }
+
+    setup_scrub(mk);
+    setup_debugfs(mk);
+    setup_irq(mk);
+
+    // userspace gets at the Knob only once everything behind it is set up
+    ret = setup_chardev(mk);
+    if (ret < 0) {
+        goto err_chardev;
+    }
 
-    int sysfs_setup_result = setup_sysfs();
-    if (sysfs_setup_result < 0) {
-        return sysfs_setup_result;
+    ret = sysfs_create_groups(&mk->kobj, motorknob_groups);
+    if (ret < 0) {
+        goto err_groups;
     }
 
+    mutex_lock(&motorknob_devices_lock);
+    list_add_tail(&mk->node, &motorknob_devices);
+    mutex_unlock(&motorknob_devices_lock);
+
+    kobject_uevent(&mk->kobj, KOBJ_ADD);
+
     // Better not use this. it is easy to use but not the right place
     // use sysfs instead
     // proc_file = proc_create("motorknob", 0666, NULL, &fops);
@@ -233,15 +4911,83 @@ static int my_i2c_probe(struct i2c_client *client) {
     //}
 
     return 0;
+
+err_groups:
+    destroy_chardev(mk);
+err_chardev:
+    destroy_irq(mk);
+    destroy_debugfs(mk);
+    destroy_scrub(mk);
+    destroy_hid(mk);
+    destroy_sampler(mk);
+    kobject_put(&mk->kobj);
+    return ret;
+}
+
+/**
+ * Drops every link from and to a Knob that is going away, before its sampler does
+ * It is off motorknob_devices already, so no new link can find it
+ */
+static void destroy_links(struct motorknob *mk) {
+    struct motorknob *other, *target;
+    int refs = 0;
+
+    mutex_lock(&motorknob_devices_lock);
+    list_for_each_entry(other, &motorknob_devices, node) {
+        if (rcu_access_pointer(other->link.target) == mk) {
+            RCU_INIT_POINTER(other->link.target, NULL);
+            refs++;
+        }
+    }
+    target = rcu_replace_pointer(mk->link.target, NULL, lockdep_is_held(&motorknob_devices_lock));
+    mutex_unlock(&motorknob_devices_lock);
+
+    // sampling paths still driving it are done after this
+    synchronize_rcu();
+
+    while (refs--) {
+        kobject_put(&mk->kobj);
+    }
+    if (target) {
+        kobject_put(&target->kobj);
+    }
 }
 
 /**
  * Gets called when a device is removed
  */
 static void my_i2c_remove(struct i2c_client *client) {
+    struct motorknob *mk = i2c_get_clientdata(client);
+
     dev_info(&client->dev, "I2C Motorknob client removed\n");
-    
-    destory_sysfs();
+
+    mutex_lock(&motorknob_devices_lock);
+    list_del(&mk->node);
+    mutex_unlock(&motorknob_devices_lock);
+
+    // waits for running sysfs calls
+    sysfs_remove_groups(&mk->kobj, motorknob_groups);
+    sysfs_remove_link(&mk->kobj, "device");
+    kobject_del(&mk->kobj);
+
+    destroy_links(mk);
+
+    destroy_chardev(mk);
+    destroy_irq(mk);
+    destroy_debugfs(mk);
+    destroy_scrub(mk);
+    destroy_hid(mk);
+    destroy_sampler(mk);
+
+    // the interrupt and the bus thread are done with it, a sample from elsewhere is waited out
+    if (mk->control.enabled) {
+        WRITE_ONCE(mk->control.enabled, false);
+        mutex_lock(&mk->sample_mutex);
+        i2c_smbus_write_word_data(client, WRITE_TORQUE, 0);
+        mutex_unlock(&mk->sample_mutex);
+    }
+
+    kobject_put(&mk->kobj);
     //proc_remove(proc_file);
 }
 
@@ -262,4 +5008,59 @@ static struct i2c_driver motorknob_i2c_driver = {
     .probe = my_i2c_probe,
     .remove = my_i2c_remove,
 };
-module_i2c_driver(motorknob_i2c_driver);
+
+static int __init motorknob_init(void) {
+    int ret = setup_sysfs();
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = misc_register(&motorknob_ctl_dev);
+    if (ret < 0) {
+        destory_sysfs();
+        return ret;
+    }
+
+    motorknob_wq = alloc_workqueue("motorknob", WQ_UNBOUND, 0);
+    if (!motorknob_wq) {
+        misc_deregister(&motorknob_ctl_dev);
+        destory_sysfs();
+        return -ENOMEM;
+    }
+
+    motorknob_seq_worker = motorknob_run_worker("motorknob/seq");
+    if (IS_ERR(motorknob_seq_worker)) {
+        destroy_workqueue(motorknob_wq);
+        misc_deregister(&motorknob_ctl_dev);
+        destory_sysfs();
+        return PTR_ERR(motorknob_seq_worker);
+    }
+    sched_set_fifo(motorknob_seq_worker->task);
+
+    motorknob_debugfs = debugfs_create_dir("motorknob", NULL);
+
+    ret = i2c_add_driver(&motorknob_i2c_driver);
+    if (ret < 0) {
+        debugfs_remove_recursive(motorknob_debugfs);
+        kthread_destroy_worker(motorknob_seq_worker);
+        destroy_workqueue(motorknob_wq);
+        misc_deregister(&motorknob_ctl_dev);
+        destory_sysfs();
+        return ret;
+    }
+
+    return 0;
+}
+
+static void __exit motorknob_exit(void) {
+    i2c_del_driver(&motorknob_i2c_driver);
+    debugfs_remove_recursive(motorknob_debugfs);
+    kthread_destroy_worker(motorknob_seq_worker);
+    destroy_workqueue(motorknob_wq);
+    misc_deregister(&motorknob_ctl_dev);
+    destory_sysfs();
+}
+
+module_init(motorknob_init);
+module_exit(motorknob_exit);
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints of the MotorKnob driver
+ * One sample passes begin, end and (if anybody reads the history) reader.
+ * All times are CLOCK_MONOTONIC ns, so they line up whatever trace_clock is set to.
+ * tools/mk-latency.py turns them into a per stage latency breakdown.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM motorknob
+
+#if !defined(_MOTORKNOB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MOTORKNOB_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * The thread starts on a sample
+ * event_ns is the timer expiry or the interrupt time, begin_ns when the thread got to it
+ */
+TRACE_EVENT(motorknob_sample_begin,
+    TP_PROTO(int index, bool irq, u64 event_ns, u64 begin_ns),
+    TP_ARGS(index, irq, event_ns, begin_ns),
+
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(bool, irq)
+        __field(u64, event_ns)
+        __field(u64, begin_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->irq = irq;
+        __entry->event_ns = event_ns;
+        __entry->begin_ns = begin_ns;
+    ),
+
+    TP_printk("knob=%d source=%s event_ns=%llu begin_ns=%llu",
+              __entry->index, __entry->irq ? "irq" : "tick", __entry->event_ns, __entry->begin_ns)
+);
+
+/**
+ * A sample was published
+ * xfer_ns is the bus transfer alone, timestamp_ns what readers see as the sample time
+ */
+TRACE_EVENT(motorknob_sample_end,
+    TP_PROTO(int index, int result, u64 xfer_ns, u64 timestamp_ns, u64 end_ns),
+    TP_ARGS(index, result, xfer_ns, timestamp_ns, end_ns),
+
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(int, result)
+        __field(u64, xfer_ns)
+        __field(u64, timestamp_ns)
+        __field(u64, end_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->result = result;
+        __entry->xfer_ns = xfer_ns;
+        __entry->timestamp_ns = timestamp_ns;
+        __entry->end_ns = end_ns;
+    ),
+
+    TP_printk("knob=%d result=%d xfer_ns=%llu timestamp_ns=%llu end_ns=%llu",
+              __entry->index, __entry->result, __entry->xfer_ns, __entry->timestamp_ns, __entry->end_ns)
+);
+
+/**
+ * A reader picked up samples from the history, newest_ns is the timestamp of the newest one
+ */
+TRACE_EVENT(motorknob_reader,
+    TP_PROTO(int index, u32 count, u64 newest_ns, u64 now_ns),
+    TP_ARGS(index, count, newest_ns, now_ns),
+
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(u32, count)
+        __field(u64, newest_ns)
+        __field(u64, now_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->count = count;
+        __entry->newest_ns = newest_ns;
+        __entry->now_ns = now_ns;
+    ),
+
+    TP_printk("knob=%d count=%u newest_ns=%llu now_ns=%llu",
+              __entry->index, __entry->count, __entry->newest_ns, __entry->now_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE motorknob_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+# Per stage latency breakdown of the MotorKnob driver from its tracepoints
+#
+#   wake     timer tick / interrupt until the thread starts on the sample
+#   bus      the i2c transfer
+#   publish  history, HID and wakeups after the transfer
+#   reader   sample published until a reader picked it up from the history
+#   total    tick / interrupt until a reader had it
+#
+# usage: mk-latency.py --record SECONDS [--hist] [--knob N]
+#        mk-latency.py [trace file, default stdin] [--hist] [--knob N]
+#
+# A trace file is the text of tracing/trace, trace_pipe or trace-cmd report
+# with the motorknob events enabled.
+
+import argparse
+import os
+import re
+import sys
+import time
+
+TRACING = ["/sys/kernel/tracing", "/sys/kernel/debug/tracing"]
+EVENT = re.compile(r"\b(motorknob_sample_begin|motorknob_sample_end|motorknob_reader): (.*)$")
+STAGES = ["wake", "bus", "publish", "reader", "total"]
+
+# samples per Knob kept around to match readers against, a reader this far behind is not a latency problem
+MATCH_WINDOW = 100000
+
+
+def tracing_dir():
+    for path in TRACING:
+        if os.path.exists(os.path.join(path, "trace_pipe")):
+            return path
+    sys.exit("tracefs not found, is it mounted?")
+
+
+def record(seconds):
+    path = tracing_dir()
+    enable = os.path.join(path, "events", "motorknob", "enable")
+    if not os.path.exists(enable):
+        sys.exit("no motorknob events, is the driver loaded?")
+
+    with open(enable, "w") as f:
+        f.write("1")
+    lines = []
+    try:
+        fd = os.open(os.path.join(path, "trace_pipe"), os.O_RDONLY | os.O_NONBLOCK)
+        end = time.monotonic() + seconds
+        buf = b""
+        while time.monotonic() < end:
+            try:
+                data = os.read(fd, 1 << 16)
+            except BlockingIOError:
+                time.sleep(0.05)
+                continue
+            buf += data
+            *complete, buf = buf.split(b"\n")
+            lines += [l.decode(errors="replace") for l in complete]
+        os.close(fd)
+    finally:
+        with open(enable, "w") as f:
+            f.write("0")
+    return lines
+
+
+def fields(text):
+    return dict(kv.split("=", 1) for kv in text.split())
+
+
+def analyze(lines, knob):
+    stages = {source: {stage: [] for stage in STAGES} for source in ("tick", "irq")}
+    pending = {}   # knob -> begin fields
+    published = {} # knob -> {timestamp_ns: (source, event_ns, end_ns)}
+    errors = 0
+
+    for line in lines:
+        m = EVENT.search(line)
+        if not m:
+            continue
+        event, f = m.group(1), fields(m.group(2))
+        index = int(f["knob"])
+        if knob is not None and index != knob:
+            continue
+
+        if event == "motorknob_sample_begin":
+            pending[index] = f
+        elif event == "motorknob_sample_end":
+            begin = pending.pop(index, None)
+            if begin is None:
+                continue
+            if int(f["result"]) < 0:
+                errors += 1
+                continue
+            source = begin["source"]
+            event_ns, begin_ns = int(begin["event_ns"]), int(begin["begin_ns"])
+            xfer_ns, end_ns = int(f["xfer_ns"]), int(f["end_ns"])
+            s = stages[source]
+            s["wake"].append(begin_ns - event_ns)
+            s["bus"].append(xfer_ns)
+            s["publish"].append(end_ns - begin_ns - xfer_ns)
+            samples = published.setdefault(index, {})
+            samples[int(f["timestamp_ns"])] = (source, event_ns, end_ns)
+            if len(samples) > MATCH_WINDOW:
+                del samples[next(iter(samples))]
+        else:
+            sample = published.get(index, {}).get(int(f["newest_ns"]))
+            if sample is None:
+                continue
+            source, event_ns, end_ns = sample
+            now_ns = int(f["now_ns"])
+            stages[source]["reader"].append(now_ns - end_ns)
+            stages[source]["total"].append(now_ns - event_ns)
+
+    return stages, errors
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def histogram(values):
+    buckets = {}
+    for v in values:
+        b = max(0, v).bit_length()
+        buckets[b] = buckets.get(b, 0) + 1
+    peak = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        low = (1 << (b - 1)) if b else 0
+        print("    %10.1f us %8d %s" % (low / 1000, n, "#" * (50 * n // peak)))
+
+
+def report(stages, errors, hist):
+    for source, s in stages.items():
+        if not s["bus"]:
+            continue
+        print("%s (%d samples)" % (source, len(s["bus"])))
+        print("  %-8s %10s %10s %10s %10s %10s %10s" % ("stage", "mean", "p50", "p90", "p99", "p99.9", "max"))
+        for stage in STAGES:
+            values = sorted(s[stage])
+            if not values:
+                continue
+            print("  %-8s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f us" % (
+                stage, sum(values) / len(values) / 1000,
+                percentile(values, 50) / 1000, percentile(values, 90) / 1000,
+                percentile(values, 99) / 1000, percentile(values, 99.9) / 1000, values[-1] / 1000))
+        if hist:
+            for stage in STAGES:
+                if s[stage]:
+                    print("  %s" % stage)
+                    histogram(s[stage])
+        print()
+    if errors:
+        print("%d failed reads" % errors)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Latency breakdown of MotorKnob samples from the driver tracepoints")
+    parser.add_argument("trace", nargs="?", help="trace text, default stdin")
+    parser.add_argument("--record", type=float, metavar="SECONDS", help="enable the events and trace for SECONDS")
+    parser.add_argument("--knob", type=int, help="only this Knob")
+    parser.add_argument("--hist", action="store_true", help="print log2 histograms per stage")
+    args = parser.parse_args()
+
+    if args.record:
+        lines = record(args.record)
+    elif args.trace:
+        with open(args.trace, errors="replace") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin
+
+    stages, errors = analyze(lines, args.knob)
+    report(stages, errors, args.hist)
+
+
+if __name__ == "__main__":
+    main()
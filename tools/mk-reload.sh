@@ -0,0 +1,44 @@
+#!/bin/sh
+# Reloads the MotorKnob driver without losing what userspace configured
+# Saves knobN/state of every Knob, reloads the module and writes the states back.
+# Knobs are matched by their i2c device, indices may change over a reload.
+#
+# usage: mk-reload.sh [motorknob_driver.ko, default modprobe]
+
+set -e
+
+SYSFS=/sys/motorknob
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+device_of() {
+    basename "$(readlink -f "$1/device")"
+}
+
+for knob in "$SYSFS"/knob*; do
+    [ -e "$knob/state" ] || continue
+    cat "$knob/state" > "$DIR/$(device_of "$knob")"
+done
+
+rmmod motorknob_driver
+if [ -n "$1" ]; then
+    insmod "$1"
+else
+    modprobe motorknob_driver
+fi
+
+# Knobs probe asynchronously, give them 5s to show up
+for state in "$DIR"/*; do
+    [ -e "$state" ] || continue
+    device=$(basename "$state")
+    for i in $(seq 50); do
+        for knob in "$SYSFS"/knob*; do
+            if [ -e "$knob/state" ] && [ "$(device_of "$knob")" = "$device" ]; then
+                cat "$state" > "$knob/state" || echo "$device could not be restored" >&2
+                continue 3
+            fi
+        done
+        sleep 0.1
+    done
+    echo "$device did not come back, its state is lost" >&2
+done
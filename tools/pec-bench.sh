@@ -0,0 +1,35 @@
+#!/bin/bash
+# Measures what SMBus PEC costs on position reads
+# Every read of /sys/motorknob/knobN/position is one bus transaction
+#
+# usage: pec-bench.sh [knob] [reads]
+
+SYSFS=/sys/motorknob/${1:-knob0}
+READS=${2:-2000}
+
+if [ "$(cat $SYSFS/pec/available)" != "1" ]; then
+    echo "PEC not available (Knob firmware or adapter)" >&2
+    exit 1
+fi
+
+old_policy=$(cat $SYSFS/pec/position)
+
+bench() {
+    echo "$1" > $SYSFS/pec/position
+    echo 0 > $SYSFS/pec/errors
+
+    start=$(date +%s%N)
+    for ((i = 0; i < READS; i++)); do
+        read -r -N 2 _ < $SYSFS/position
+    done
+    end=$(date +%s%N)
+
+    ns=$(( (end - start) / READS ))
+    printf "%-4s %8d ns/read %8d reads/s  %s\n" "$1" "$ns" "$(( 1000000000 / ns ))" "$(cat $SYSFS/pec/errors)"
+}
+
+bench off
+bench on
+bench auto
+
+echo "$old_policy" > $SYSFS/pec/position